@@ -1,162 +1,377 @@
-#include <iot_button.h>
 #include "button_handler.h"
+#include "gesture_map.h"
 #include <esp_log.h>
-#include <freertos/FreeRTOS.h>
-#include <freertos/task.h>
-#include <freertos/queue.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
+#include <esp_sleep.h>
 #include "sdkconfig.h"
+#ifdef CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
 
 static const char *TAG = "button_handler";
 
-static button_callback_t g_user_callback = NULL;
-static void *g_user_data = NULL;
-static button_handle_t g_button_up = NULL;
-static button_handle_t g_button_down = NULL;
-static QueueHandle_t g_button_event_queue = NULL;
+#define BUTTON_COUNT 2
+#define BUTTON_ACTIVE_LEVEL 0 // Активный низкий уровень (кнопка замыкает на GND)
+
+// Автомат распознавания собирается из GESTURE_MAP при компиляции
+static constexpr gesture_table_t GESTURE_TABLE = gesture_compile();
+
+// Фазы автомата распознавания жестов
+typedef enum
+{
+    GESTURE_IDLE,
+    GESTURE_DOWN,    // Кнопки нажаты, ждем отпускания или удержания
+    GESTURE_GAP,     // Кнопки отпущены, ждем следующего нажатия
+    GESTURE_HOLDING, // Удержание сообщено, ждем отпускания
+    GESTURE_DONE     // Жест сообщен, ждем отпускания всех кнопок
+} gesture_phase_t;
+
+typedef struct
+{
+    gesture_phase_t phase;
+    uint8_t buttons;       // Кнопки, участвующие в жесте
+    uint8_t clicks;        // Число нажатий в жесте
+    uint8_t hold_binding;  // Привязка, сработавшая по удержанию
+    int64_t press_time_us; // Время первого нажатия жеста
+    esp_timer_handle_t timer;
+} gesture_t;
 
-// Внутренняя структура для событий кнопок
 typedef struct
 {
-    button_event_t event;
-    button_id_t button_id;
-} button_event_msg_t;
+    button_id_t id;
+    gpio_num_t gpio;
+    bool pressed;         // Состояние после подавления дребезга
+    int64_t edge_time_us; // Время первого фронта в пачке дребезга
+    esp_timer_handle_t debounce_timer;
+} button_t;
+
+static button_callback_t g_user_callback = NULL;
+static void *g_user_data = NULL;
+static button_t g_buttons[BUTTON_COUNT];
+static gesture_t g_gesture;
+static uint8_t g_pressed_mask = 0;
 
-// Обработчики событий для кнопки вверх
-static void button_up_single_press_cb(void *button_handle, void *usr_data)
+#ifdef CONFIG_PM_ENABLE
+// Удерживается от фронта до окончания дребезга: таймер дребезга должен
+// отработать вовремя, а не после следующего пробуждения
+static esp_pm_lock_handle_t g_pm_lock = NULL;
+#endif
+
+static void gesture_dispatch(gesture_action_t action)
 {
-    button_event_msg_t msg = {.event = BUTTON_SINGLE_CLICK, .button_id = BUTTON_ID_UP};
-    xQueueSendFromISR(g_button_event_queue, &msg, NULL);
+    if (action == GESTURE_ACTION_NONE)
+    {
+        return;
+    }
+
+    button_event_msg_t msg = {
+        .action = action,
+        .buttons = g_gesture.buttons,
+        .press_time_us = g_gesture.press_time_us,
+    };
+
+    ESP_LOGD(TAG, "Gesture: buttons 0x%x, clicks %u -> action %d", g_gesture.buttons, g_gesture.clicks, action);
+
+    if (g_user_callback != NULL)
+    {
+        g_user_callback(&msg, g_user_data);
+    }
 }
 
-static void button_up_double_press_cb(void *button_handle, void *usr_data)
+static uint8_t gesture_lookup(bool hold)
 {
-    button_event_msg_t msg = {.event = BUTTON_DOUBLE_CLICK, .button_id = BUTTON_ID_UP};
-    xQueueSendFromISR(g_button_event_queue, &msg, NULL);
+    return GESTURE_TABLE.binding[g_gesture.buttons][g_gesture.clicks][hold];
 }
 
-static void button_up_long_press_cb(void *button_handle, void *usr_data)
+// Сообщить жест без удержания для текущего набора кнопок и числа нажатий
+static void gesture_fire_click(void)
 {
-    button_event_msg_t msg = {.event = BUTTON_LONG_PRESS_START, .button_id = BUTTON_ID_UP};
-    xQueueSendFromISR(g_button_event_queue, &msg, NULL);
+    uint8_t index = gesture_lookup(false);
+    if (index != GESTURE_NO_BINDING)
+    {
+        gesture_dispatch(GESTURE_MAP[index].action);
+    }
 }
 
-// Обработчики событий для кнопки вниз
-static void button_down_single_press_cb(void *button_handle, void *usr_data)
+// После нажатия: завершить жест сразу, если продолжений у него нет,
+// иначе ждать удержания
+static void gesture_after_press(void)
 {
-    button_event_msg_t msg = {.event = BUTTON_SINGLE_CLICK, .button_id = BUTTON_ID_DOWN};
-    xQueueSendFromISR(g_button_event_queue, &msg, NULL);
+    uint8_t hold = gesture_lookup(true);
+    bool can_grow = g_gesture.clicks == 1 && g_gesture.buttons != BUTTON_MASK_BOTH &&
+                    GESTURE_TABLE.chord_possible[g_gesture.buttons];
+
+    esp_timer_stop(g_gesture.timer);
+
+    if (hold == GESTURE_NO_BINDING && !can_grow &&
+        g_gesture.clicks >= GESTURE_TABLE.max_clicks[g_gesture.buttons])
+    {
+        g_gesture.phase = GESTURE_DONE;
+        gesture_fire_click();
+        return;
+    }
+
+    g_gesture.phase = GESTURE_DOWN;
+    if (hold != GESTURE_NO_BINDING)
+    {
+        esp_timer_start_once(g_gesture.timer, (uint64_t)GESTURE_MAP[hold].hold_ms * 1000);
+    }
 }
 
-static void button_down_double_press_cb(void *button_handle, void *usr_data)
+static void gesture_start(button_t *button)
 {
-    button_event_msg_t msg = {.event = BUTTON_DOUBLE_CLICK, .button_id = BUTTON_ID_DOWN};
-    xQueueSendFromISR(g_button_event_queue, &msg, NULL);
+    g_gesture.buttons = BUTTON_MASK(button->id);
+    g_gesture.clicks = 1;
+    g_gesture.press_time_us = button->edge_time_us;
+    gesture_after_press();
 }
 
-static void button_down_long_press_cb(void *button_handle, void *usr_data)
+// Переходы автомата по нажатию. Выполняется в задаче esp_timer
+static void gesture_on_press(button_t *button)
 {
-    button_event_msg_t msg = {.event = BUTTON_LONG_PRESS_START, .button_id = BUTTON_ID_DOWN};
-    xQueueSendFromISR(g_button_event_queue, &msg, NULL);
+    uint8_t mask = BUTTON_MASK(button->id);
+
+    switch (g_gesture.phase)
+    {
+    case GESTURE_IDLE:
+        gesture_start(button);
+        break;
+
+    case GESTURE_DOWN:
+        // Вторая кнопка нажата почти одновременно - аккорд
+        if (!(g_gesture.buttons & mask) && g_gesture.clicks == 1 &&
+            button->edge_time_us - g_gesture.press_time_us <= (int64_t)CONFIG_BUTTON_CHORD_WINDOW_MS * 1000)
+        {
+            g_gesture.buttons |= mask;
+            gesture_after_press();
+        }
+        break;
+
+    case GESTURE_GAP:
+        if (g_gesture.buttons & mask)
+        {
+            g_gesture.clicks++;
+            gesture_after_press();
+        }
+        else
+        {
+            // Другая кнопка - завершаем текущий жест и начинаем новый
+            esp_timer_stop(g_gesture.timer);
+            gesture_fire_click();
+            gesture_start(button);
+        }
+        break;
+
+    default:
+        break;
+    }
 }
 
-// Функция обработки одновременного нажатия
-static void check_simultaneous_press_task(void *arg)
+// Переходы автомата по отпусканию. Выполняется в задаче esp_timer
+static void gesture_on_release(button_t *button)
 {
-    bool both_pressed = false;
-    TickType_t press_start_time = 0;
-    const TickType_t simultaneous_threshold = pdMS_TO_TICKS(100); // 100ms для одновременного нажатия
+    uint8_t mask = BUTTON_MASK(button->id);
+    bool all_released = (g_pressed_mask & g_gesture.buttons) == 0;
 
-    while (true)
+    switch (g_gesture.phase)
     {
-        bool up_pressed = (iot_button_get_event(g_button_up) == BUTTON_PRESS_DOWN);
-        bool down_pressed = (iot_button_get_event(g_button_down) == BUTTON_PRESS_DOWN);
+    case GESTURE_DOWN:
+        if (!all_released)
+        {
+            break;
+        }
+        esp_timer_stop(g_gesture.timer);
+        if (g_gesture.clicks < GESTURE_TABLE.max_clicks[g_gesture.buttons])
+        {
+            g_gesture.phase = GESTURE_GAP;
+            esp_timer_start_once(g_gesture.timer, (uint64_t)CONFIG_BUTTON_DOUBLE_CLICK_MS * 1000);
+        }
+        else
+        {
+            g_gesture.phase = GESTURE_IDLE;
+            gesture_fire_click();
+        }
+        break;
 
-        if (up_pressed && down_pressed && !both_pressed)
+    case GESTURE_HOLDING:
+        if (g_gesture.buttons & mask)
         {
-            // Обе кнопки нажаты
-            both_pressed = true;
-            press_start_time = xTaskGetTickCount();
+            g_gesture.phase = all_released ? GESTURE_IDLE : GESTURE_DONE;
+            gesture_dispatch(GESTURE_MAP[g_gesture.hold_binding].release_action);
         }
-        else if (!up_pressed || !down_pressed)
+        break;
+
+    case GESTURE_DONE:
+        if (all_released)
         {
-            // Хотя бы одна кнопка отпущена
-            if (both_pressed)
-            {
-                TickType_t press_duration = xTaskGetTickCount() - press_start_time;
-                if (press_duration < simultaneous_threshold)
-                {
-                    // Кнопки были нажаты одновременно в течение короткого времени
-                    button_event_msg_t msg = {.event = (button_event_t)BUTTON_EVENT_SIMULTANEOUS_PRESS};
-                    xQueueSend(g_button_event_queue, &msg, 0);
-                }
-            }
-            both_pressed = false;
+            g_gesture.phase = GESTURE_IDLE;
         }
+        break;
 
-        vTaskDelay(pdMS_TO_TICKS(10)); // Проверяем каждые 10ms
+    default:
+        break;
     }
 }
 
+// Истекло время ожидания: удержание или окончание серии нажатий
+static void gesture_timer_cb(void *arg)
+{
+    switch (g_gesture.phase)
+    {
+    case GESTURE_DOWN:
+        g_gesture.hold_binding = gesture_lookup(true);
+        if (g_gesture.hold_binding != GESTURE_NO_BINDING)
+        {
+            g_gesture.phase = GESTURE_HOLDING;
+            gesture_dispatch(GESTURE_MAP[g_gesture.hold_binding].action);
+        }
+        break;
+
+    case GESTURE_GAP:
+        g_gesture.phase = GESTURE_IDLE;
+        gesture_fire_click();
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Прерывание по уровню, противоположному текущему состоянию кнопки. В отличие
+// от прерывания по фронту уровень будит чип из легкого сна
+static void button_arm(button_t *button)
+{
+    int level = button->pressed ? !BUTTON_ACTIVE_LEVEL : BUTTON_ACTIVE_LEVEL;
+    gpio_wakeup_enable(button->gpio, level ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+    gpio_intr_enable(button->gpio);
+}
+
+// Окончание дребезга: фиксируем уровень и снова разрешаем прерывание
+static void button_debounce_timer_cb(void *arg)
+{
+    button_t *button = (button_t *)arg;
+    bool pressed = gpio_get_level(button->gpio) == BUTTON_ACTIVE_LEVEL;
+
+    if (pressed != button->pressed)
+    {
+        button->pressed = pressed;
+        if (pressed)
+        {
+            g_pressed_mask |= BUTTON_MASK(button->id);
+            gesture_on_press(button);
+        }
+        else
+        {
+            g_pressed_mask &= ~BUTTON_MASK(button->id);
+            gesture_on_release(button);
+        }
+    }
+
+    button_arm(button);
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_lock_release(g_pm_lock);
+#endif
+}
+
+static void IRAM_ATTR button_gpio_isr_handler(void *arg)
+{
+    button_t *button = (button_t *)arg;
+
+    // Прерывание отключается до окончания дребезга, поэтому срабатывает один раз на пачку фронтов
+    gpio_intr_disable(button->gpio);
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_lock_acquire(g_pm_lock);
+#endif
+    button->edge_time_us = esp_timer_get_time();
+    esp_timer_start_once(button->debounce_timer, (uint64_t)CONFIG_BUTTON_DEBOUNCE_MS * 1000);
+}
+
+static esp_err_t button_create(button_t *button, button_id_t id, gpio_num_t gpio)
+{
+    button->id = id;
+    button->gpio = gpio;
+
+    gpio_config_t io_conf = {
+        .pin_bit_mask = (1ULL << gpio),
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE};
+    esp_err_t ret = gpio_config(&io_conf);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    button->pressed = gpio_get_level(gpio) == BUTTON_ACTIVE_LEVEL;
+    if (button->pressed)
+    {
+        g_pressed_mask |= BUTTON_MASK(id);
+    }
+
+    esp_timer_create_args_t debounce_args = {
+        .callback = &button_debounce_timer_cb,
+        .arg = button,
+        .name = "button_debounce"};
+    ret = esp_timer_create(&debounce_args, &button->debounce_timer);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    ret = gpio_isr_handler_add(gpio, button_gpio_isr_handler, button);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    button_arm(button);
+    return ESP_OK;
+}
+
 void button_handler_init(void)
 {
     ESP_LOGI(TAG, "Initializing button handler");
 
-    // Создаем очередь для событий кнопок
-    g_button_event_queue = xQueueCreate(10, sizeof(button_event_msg_t));
-    if (g_button_event_queue == NULL)
+    esp_err_t ret = gpio_install_isr_service(0);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE)
     {
-        ESP_LOGE(TAG, "Failed to create button event queue");
+        ESP_LOGE(TAG, "Failed to install GPIO ISR service: %s", esp_err_to_name(ret));
         return;
     }
 
-    // Инициализация кнопки вверх
-    button_config_t up_button_config = {
-        .type = BUTTON_TYPE_GPIO,
-        .long_press_time = CONFIG_BUTTON_LONG_PRESS_MS,
-        .short_press_time = 50,
-        .gpio_button_config = {
-            .gpio_num = CONFIG_BUTTON_UP_PIN,
-            .active_level = 0, // Активный низкий уровень (кнопка замыкает на GND)
-        },
-    };
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "button", &g_pm_lock);
+#endif
+    // Нажатие кнопки будит чип из легкого сна
+    esp_sleep_enable_gpio_wakeup();
 
-    g_button_up = iot_button_create(&up_button_config);
-    if (g_button_up == NULL)
+    esp_timer_create_args_t gesture_args = {
+        .callback = &gesture_timer_cb,
+        .arg = NULL,
+        .name = "button_gesture"};
+    ret = esp_timer_create(&gesture_args, &g_gesture.timer);
+    if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to create up button");
+        ESP_LOGE(TAG, "Failed to create gesture timer: %s", esp_err_to_name(ret));
         return;
     }
 
-    // Инициализация кнопки вниз
-    button_config_t down_button_config = {
-        .type = BUTTON_TYPE_GPIO,
-        .long_press_time = CONFIG_BUTTON_LONG_PRESS_MS,
-        .short_press_time = 50,
-        .gpio_button_config = {
-            .gpio_num = CONFIG_BUTTON_DOWN_PIN,
-            .active_level = 0, // Активный низкий уровень
-        },
-    };
-
-    g_button_down = iot_button_create(&down_button_config);
-    if (g_button_down == NULL)
+    ret = button_create(&g_buttons[BUTTON_ID_UP], BUTTON_ID_UP, (gpio_num_t)CONFIG_BUTTON_UP_PIN);
+    if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to create down button");
+        ESP_LOGE(TAG, "Failed to create up button: %s", esp_err_to_name(ret));
         return;
     }
 
-    // Регистрация обработчиков для кнопки вверх
-    iot_button_register_cb(g_button_up, BUTTON_SINGLE_CLICK, button_up_single_press_cb, NULL);
-    iot_button_register_cb(g_button_up, BUTTON_DOUBLE_CLICK, button_up_double_press_cb, NULL);
-    iot_button_register_cb(g_button_up, BUTTON_LONG_PRESS_START, button_up_long_press_cb, NULL);
-
-    // Регистрация обработчиков для кнопки вниз
-    iot_button_register_cb(g_button_down, BUTTON_SINGLE_CLICK, button_down_single_press_cb, NULL);
-    iot_button_register_cb(g_button_down, BUTTON_DOUBLE_CLICK, button_down_double_press_cb, NULL);
-    iot_button_register_cb(g_button_down, BUTTON_LONG_PRESS_START, button_down_long_press_cb, NULL);
-
-    // Создаем задачу для определения одновременного нажатия
-    xTaskCreate(check_simultaneous_press_task, "simultaneous_press", 2048, NULL, 5, NULL);
+    ret = button_create(&g_buttons[BUTTON_ID_DOWN], BUTTON_ID_DOWN, (gpio_num_t)CONFIG_BUTTON_DOWN_PIN);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create down button: %s", esp_err_to_name(ret));
+        return;
+    }
 
     ESP_LOGI(TAG, "Button handler initialized successfully");
 }
@@ -166,25 +381,3 @@ void button_handler_set_callback(button_callback_t callback, void *user_data)
     g_user_callback = callback;
     g_user_data = user_data;
 }
-
-void button_handler_task(void *arg)
-{
-    button_event_msg_t msg;
-
-    ESP_LOGI(TAG, "Button handler task started");
-
-    while (true)
-    {
-        // Ожидаем события от кнопок
-        if (xQueueReceive(g_button_event_queue, &msg, portMAX_DELAY) == pdTRUE)
-        {
-            ESP_LOGD(TAG, "Button event received: %d", msg.event);
-
-            // Вызываем пользовательский callback если он установлен
-            if (g_user_callback != NULL)
-            {
-                g_user_callback(msg.event, msg.button_id, g_user_data);
-            }
-        }
-    }
-}
@@ -3,26 +3,12 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <iot_button.h>
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
-    // Custom events that extend iot_button.h functionality
-    typedef enum
-    {
-        BUTTON_EVENT_SHORT_PRESS_UP = BUTTON_SINGLE_CLICK,
-        BUTTON_EVENT_SHORT_PRESS_DOWN = BUTTON_SINGLE_CLICK,
-        BUTTON_EVENT_DOUBLE_PRESS_UP = BUTTON_DOUBLE_CLICK,
-        BUTTON_EVENT_DOUBLE_PRESS_DOWN = BUTTON_DOUBLE_CLICK,
-        BUTTON_EVENT_LONG_PRESS_UP = BUTTON_LONG_PRESS_START,
-        BUTTON_EVENT_LONG_PRESS_DOWN = BUTTON_LONG_PRESS_START,
-        BUTTON_EVENT_SIMULTANEOUS_PRESS = 100, // Custom event value
-        BUTTON_EVENT_RELEASE = BUTTON_PRESS_UP
-    } custom_button_event_t;
-
     // Button identifier to distinguish between different physical buttons
     typedef enum
     {
@@ -30,12 +16,40 @@ extern "C"
         BUTTON_ID_DOWN = 1
     } button_id_t;
 
-    // Enhanced callback that includes button identification
-    typedef void (*button_callback_t)(button_event_t event, button_id_t button_id, void *user_data);
+    // Button sets used in gesture patterns
+#define BUTTON_MASK(id) (1u << (id))
+#define BUTTON_MASK_UP BUTTON_MASK(BUTTON_ID_UP)
+#define BUTTON_MASK_DOWN BUTTON_MASK(BUTTON_ID_DOWN)
+#define BUTTON_MASK_BOTH (BUTTON_MASK_UP | BUTTON_MASK_DOWN)
+
+    // Actions bound to gestures in gesture_map.h
+    typedef enum
+    {
+        GESTURE_ACTION_NONE,
+        GESTURE_ACTION_CALIBRATE,    // Enter or leave calibration mode
+        GESTURE_ACTION_GOTO_TOP,     // Move to the top, or confirm a calibration point
+        GESTURE_ACTION_GOTO_BOTTOM,  // Move to the bottom, or confirm a calibration point
+        GESTURE_ACTION_PRESET,       // Zebra stripe toggle or the 50% position
+        GESTURE_ACTION_JOG_UP,       // Move up while held
+        GESTURE_ACTION_JOG_DOWN,     // Move down while held
+        GESTURE_ACTION_STOP,         // Release after a hold
+        GESTURE_ACTION_SELECT_SHADE, // Switch the buttons to the next shade or to all shades
+        GESTURE_ACTION_COUNT
+    } gesture_action_t;
+
+    // Recognized gesture delivered to the subscriber
+    typedef struct
+    {
+        gesture_action_t action;
+        uint8_t buttons;       // BUTTON_MASK_* of the buttons taking part in the gesture
+        int64_t press_time_us; // esp_timer time of the press edge that started the gesture
+    } button_event_msg_t;
+
+    // Called from the esp_timer task; the subscriber must not block
+    typedef void (*button_callback_t)(const button_event_msg_t *msg, void *user_data);
 
     void button_handler_init(void);
     void button_handler_set_callback(button_callback_t callback, void *user_data);
-    void button_handler_task(void *arg);
 
 #ifdef __cplusplus
 }
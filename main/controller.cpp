@@ -1,467 +1,1621 @@
 #include "controller.h"
+#include <stddef.h>
+#include <stdlib.h>
 #include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "esp_rom_crc.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "nvs.h"
 #include "sdkconfig.h"
 #include "motor_control.h"
+#include "motion_planner.h"
 
 static const char *TAG = "controller";
 
-// Кэш конфигурации
-static config_t g_config = {0};
+// Параметры измерения люфта
+#define BACKLASH_MAX_STEPS CONFIG_MOTOR_BACKLASH_MAX_STEPS
+#define BACKLASH_PROBE_STEPS 8
+#define BACKLASH_ADC_THRESHOLD 8 // Изменение АЦП, считающееся началом движения шторы
 
-// Флаги состояния
-static bool g_button_held = false;
-static calibration_step_callback_t g_calibration_callback = NULL;
+// Минимальное изменение АЦП за окно остановки, если ход в шагах не откалиброван
+#define STALL_UNCALIBRATED_MIN_COUNTS 4
 
-// Задача для периодической проверки границ
-static TaskHandle_t g_boundary_check_task = NULL;
+#define STATE_CALLBACKS_MAX 4
 
-// Объявления функций
-static void controller_button_callback(button_event_t event, button_id_t button_id, void *user_data);
-static void controller_move_to_percentage(float percentage);
-static void controller_handle_zebra_offset(void);
-static bool controller_check_boundaries_and_stop(void);
+#define MOTION_RECORD_MAGIC 0x4D4F5645 // "MOVE"
 
-void controller_init(void)
+// Тип движения, зеркалируемого в RTC память
+typedef enum
 {
-    ESP_LOGI(TAG, "Initializing controller");
+    MOTION_RECORD_NONE,
+    MOTION_RECORD_TARGET,    // Движение к заданной позиции
+    MOTION_RECORD_CONTINUOUS // Движение до остановки (удержание кнопки)
+} motion_record_mode_t;
+
+// Запись об активном движении. Переживает brownout и сброс по watchdog,
+// но не отключение питания
+typedef struct
+{
+    uint32_t magic;
+    uint32_t mode;
+    uint32_t direction;
+    int32_t target_steps;
+    int32_t position_steps;
+    uint32_t resume_attempts;
+    uint32_t checksum;
+} motion_rtc_record_t;
+
+// Запись на каждую штору платы
+static RTC_NOINIT_ATTR motion_rtc_record_t g_motion_records[CONFIG_SHADE_COUNT];
+static esp_reset_reason_t g_reset_reason = ESP_RST_UNKNOWN;
+
+// Подписчики на смену состояния
+typedef struct
+{
+    controller_state_callback_t callback;
+    void *user_data;
+} state_callback_entry_t;
 
-    // Инициализация подсистем
-    motor_control_init();
-    position_sensor_init();
-    button_handler_init();
+static state_callback_entry_t g_state_callbacks[STATE_CALLBACKS_MAX];
+static uint8_t g_state_callback_count = 0;
 
-    // Установка callback для кнопок
-    button_handler_set_callback(controller_button_callback, NULL);
+// Подписчики на изменение позиции
+typedef struct
+{
+    controller_position_callback_t callback;
+    void *user_data;
+} position_callback_entry_t;
 
-    // Установка начального состояния
-    g_config.state = IDLE;
-    g_config.auto_calibrate = !position_sensor_is_calibrated();
+static position_callback_entry_t g_position_callbacks[STATE_CALLBACKS_MAX];
+static uint8_t g_position_callback_count = 0;
 
-    ESP_LOGI(TAG, "Controller initialized. Calibrated: %s",
-             position_sensor_is_calibrated() ? "Yes" : "No");
-}
+// Подписчики регистрируются из параллельных задач запуска сетевых стеков.
+// Таблицы только растут: запись целиком и счетчик меняются под блокировкой,
+// уведомление берет снимок счетчика и вызывает записи уже без нее
+static portMUX_TYPE g_callback_lock = portMUX_INITIALIZER_UNLOCKED;
 
-void controller_move_to_position(uint32_t position)
-{
-    if (g_config.state == CALIBRATING)
-    {
-        ESP_LOGW(TAG, "Cannot move to position during calibration");
-        return;
-    }
+// Наблюдение за движением: границы и проскальзывание. Задача просыпается только
+// по событиям мотора: по паре бит уведомления на штору
+#define MONITOR_EVENT_SEGMENT(shade) (1 << (2 * (shade)))
+#define MONITOR_EVENT_STOPPED(shade) (1 << (2 * (shade) + 1))
 
-    uint32_t current_pos = position_sensor_read();
+typedef struct
+{
+    bool active;
+    motor_direction_t direction;
+    int32_t start_steps;         // Позиция мотора в начале движения
+    int32_t window_steps;        // Позиция мотора в начале окна сравнения
+    int32_t window_sensor_steps; // Позиция по АЦП в начале окна сравнения
+    int32_t stall_steps;         // Позиция мотора в начале окна остановки
+    uint32_t stall_adc;          // Значение АЦП в начале окна остановки
+    bool slipped;
+} motion_monitor_t;
+
+// Состояние одной шторы платы
+typedef struct
+{
+    uint8_t id; // Номер шторы с нуля
+    config_t config;
+    controller_fault_t fault;
+    bool button_held;
+    calibration_step_callback_t calibration_callback;
+    motion_monitor_t monitor;
+    volatile bool monitor_restart;
+    motion_rtc_record_t *record;
+} shade_t;
+
+static shade_t g_shades[CONFIG_SHADE_COUNT];
+
+// Цель кнопок: номер шторы или CONFIG_SHADE_COUNT - все шторы сразу
+static uint8_t g_button_shade = 0;
+
+// Очередь команд контроллера: события кнопок, внешние команды и отложенная
+// работа обрабатываются в задаче контроллера
+#define COMMAND_QUEUE_LENGTH 8
+
+typedef enum
+{
+    COMMAND_GESTURE,
+    COMMAND_REQUEST,
+    COMMAND_WORK
+} command_kind_t;
 
-    if (current_pos == position)
+typedef struct
+{
+    command_kind_t kind;
+    union
     {
-        ESP_LOGI(TAG, "Already at target position: %lu", position);
-        return;
-    }
+        button_event_msg_t gesture;
+        controller_request_t request;
+        struct
+        {
+            controller_work_t fn;
+            void *arg;
+        } work;
+    };
+} command_msg_t;
 
-    ESP_LOGI(TAG, "Moving from position %lu to %lu", current_pos, position);
+static QueueHandle_t g_command_queue = NULL;
 
-    // Определяем направление на основе текущей и целевой позиций
-    motor_direction_t direction = (position > current_pos
-                                   ? MOTOR_DIR_DOWN;
-                                   : MOTOR_DIR_UP);
+// Состояние меняют задача контроллера, задача наблюдения (граница, остановка
+// мотора) и задача измерения люфта. Каждая держит мьютекс на время обработки
+static SemaphoreHandle_t g_control_mutex = NULL;
 
-    // Устанавливаем направление мотора
-    motor_set_direction(direction);
+// Задержка от нажатия кнопки до запуска мотора
+typedef struct
+{
+    uint32_t count;
+    int64_t total_us;
+    int64_t max_us;
+} press_latency_stats_t;
 
-    // Вычисляем количество шагов (упрощенный подход)
-    uint32_t position_diff = (position > current_pos) ? (position - current_pos) : (current_pos - position);
+static press_latency_stats_t g_press_latency = {0};
 
-    // Устанавливаем скорость по умолчанию
-    uint32_t speed = CONFIG_MOTOR_DEFAULT_SPEED;
-    motor_set_speed(speed);
+static TaskHandle_t g_monitor_task = NULL;
 
-    // Запускаем движение мотора
-    motor_step(position_diff);
+// Объявления функций
+static void controller_button_callback(const button_event_msg_t *msg, void *user_data);
+static void controller_handle_gesture(const button_event_msg_t *msg);
+static void controller_task(void *parameter);
+static void controller_move_to_steps(shade_t *s, int32_t target_steps, const controller_move_limits_t *limits);
+static void controller_move_to_position_limited(shade_t *s, uint32_t position, const controller_move_limits_t *limits);
+static void controller_start_continuous(shade_t *s, motor_direction_t direction, bool jog);
+static bool controller_check_boundaries_and_stop(shade_t *s);
+static void motion_monitor_task(void *parameter);
+static void controller_set_state(shade_t *s, state_t state);
+static void backlash_measure_task(void *parameter);
+static void controller_advance_calibration(shade_t *s);
+static void controller_motor_event_callback(uint8_t shade, motor_event_t event, int32_t position_steps);
+static void controller_resume_interrupted_move(shade_t *s);
+#ifdef CONFIG_ZEBRA_BLINDS_SUPPORT
+static zebra_alignment_t controller_zebra_current_alignment(shade_t *s);
+#endif
 
-    // Обновляем состояние
-    if (direction == MOTOR_DIR_UP)
-    {
-        g_config.state = MOVING_UP;
-    }
-    else
-    {
-        g_config.state = MOVING_DOWN;
-    }
+static uint32_t motion_record_checksum(shade_t *s)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)s->record,
+                            offsetof(motion_rtc_record_t, checksum));
+}
 
-    g_config.position.current_position = position;
+static bool motion_record_is_valid(shade_t *s)
+{
+    return s->record->magic == MOTION_RECORD_MAGIC &&
+           s->record->checksum == motion_record_checksum(s);
+}
 
-    // Проверяем границы сразу после запуска движения
-    controller_check_boundaries_and_stop();
+static void motion_record_begin(shade_t *s, motion_record_mode_t mode, motor_direction_t direction, int32_t target_steps)
+{
+    // Счетчик попыток возобновления не сбрасываем: он обнуляется только при штатном завершении
+    s->record->magic = MOTION_RECORD_MAGIC;
+    s->record->mode = mode;
+    s->record->direction = direction;
+    s->record->target_steps = target_steps;
+    s->record->position_steps = motor_get_position_steps(s->id);
+    s->record->checksum = motion_record_checksum(s);
 }
 
-void controller_move_up(void)
+static void motion_record_clear(shade_t *s, int32_t position_steps)
 {
-    if (g_config.state == CALIBRATING)
-    {
-        ESP_LOGW(TAG, "Cannot move up during calibration");
-        return;
-    }
+    s->record->magic = MOTION_RECORD_MAGIC;
+    s->record->mode = MOTION_RECORD_NONE;
+    s->record->direction = MOTOR_DIR_STOP;
+    s->record->target_steps = 0;
+    s->record->position_steps = position_steps;
+    s->record->resume_attempts = 0;
+    s->record->checksum = motion_record_checksum(s);
+}
 
-    ESP_LOGI(TAG, "Moving up");
-    motor_set_direction(MOTOR_DIR_UP);
+// Калибровка хода в шагах позволяет переводить значения АЦП в шаги мотора
+static bool controller_has_step_calibration(shade_t *s)
+{
+    return position_sensor_is_calibrated(s->id) && position_sensor_get_travel_steps(s->id) > 0;
+}
 
-    // Устанавливаем скорость
-    uint32_t speed = CONFIG_MOTOR_DEFAULT_SPEED;
-    motor_set_speed(speed);
+static int32_t controller_position_to_steps(shade_t *s, uint32_t position)
+{
+    uint32_t min_pos = position_sensor_get_min_position(s->id);
+    uint32_t max_pos = position_sensor_get_max_position(s->id);
 
-    // Движение вверх - можно использовать большое количество шагов для непрерывного движения
-    motor_step(UINT32_MAX);
+    if (position <= min_pos)
+        return 0;
+    if (position >= max_pos)
+        return (int32_t)position_sensor_get_travel_steps(s->id);
 
-    g_config.state = MOVING_UP;
+    return (int32_t)((uint64_t)(position - min_pos) * position_sensor_get_travel_steps(s->id) / (max_pos - min_pos));
 }
 
-void controller_move_down(void)
+// Восстановление шаговой позиции по АЦП после включения питания
+static void controller_sync_position_steps(shade_t *s)
 {
-    if (g_config.state == CALIBRATING)
+    if (!controller_has_step_calibration(s))
     {
-        ESP_LOGW(TAG, "Cannot move down during calibration");
         return;
     }
 
-    ESP_LOGI(TAG, "Moving down");
-    motor_set_direction(MOTOR_DIR_DOWN);
-
-    // Устанавливаем скорость
-    uint32_t speed = CONFIG_MOTOR_DEFAULT_SPEED;
-    motor_set_speed(speed);
-
-    // Движение вниз - можно использовать большое количество шагов для непрерывного движения
-    motor_step(UINT32_MAX);
+    motor_set_position_steps(s->id, controller_position_to_steps(s, position_sensor_read(s->id)));
+}
 
-    g_config.state = MOVING_DOWN;
+// Отметка этапа инициализации в журнале загрузки
+static void controller_boot_mark(const char *stage, int64_t *stage_us)
+{
+    int64_t now_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "Boot: %s ready at %lld ms (took %lld ms)", stage, now_us / 1000, (now_us - *stage_us) / 1000);
+    *stage_us = now_us;
 }
 
-void controller_stop(void)
+void controller_init(void)
 {
-    ESP_LOGI(TAG, "Stopping motor");
+    ESP_LOGI(TAG, "Initializing controller");
 
-    // Проверяем, движется ли мотор
-    if (motor_is_moving())
+    // Инициализация подсистем. Время каждой попадает в журнал загрузки
+    int64_t stage_us = esp_timer_get_time();
+    motor_control_init();
+    controller_boot_mark("motor", &stage_us);
+    position_sensor_init();
+    controller_boot_mark("calibration restore", &stage_us);
+    button_handler_init();
+    controller_boot_mark("buttons", &stage_us);
+    motion_planner_init();
+
+    for (uint8_t shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
     {
-        ESP_LOGI(TAG, "Motor is moving, stopping");
-        motor_stop();
+        shade_t *s = &g_shades[shade];
+        s->id = shade;
+        s->record = &g_motion_records[shade];
+        s->config.state = IDLE;
+        s->config.auto_calibrate = !position_sensor_is_calibrated(shade);
+        motion_planner_set_backlash_steps(shade, position_sensor_get_backlash_steps(shade));
+        motion_planner_set_travel_steps(shade, position_sensor_get_travel_steps(shade));
+    }
+
+    g_control_mutex = xSemaphoreCreateMutex();
+    xTaskCreate(motion_monitor_task, "motion_monitor", 3072, NULL, 10, &g_monitor_task);
+
+    g_command_queue = xQueueCreate(COMMAND_QUEUE_LENGTH, sizeof(command_msg_t));
+    if (g_command_queue == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create command queue");
     }
     else
     {
-        ESP_LOGD(TAG, "Motor already stopped");
+        xTaskCreate(controller_task, "controller", 4096, NULL, 8, NULL);
     }
 
-    g_config.state = IDLE;
-    g_button_held = false;
+    // Установка callback для кнопок
+    button_handler_set_callback(controller_button_callback, NULL);
+    motor_set_event_callback(controller_motor_event_callback);
+
+    for (uint8_t shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        ESP_LOGI(TAG, "Shade %u initialized. Calibrated: %s", shade + 1,
+                 position_sensor_is_calibrated(shade) ? "Yes" : "No");
+    }
+
+    // Возобновляем прерванные движения до запуска сетевых стеков
+    stage_us = esp_timer_get_time();
+    g_reset_reason = esp_reset_reason();
+    xSemaphoreTake(g_control_mutex, portMAX_DELAY);
+    for (uint8_t shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        controller_resume_interrupted_move(&g_shades[shade]);
+    }
+    xSemaphoreGive(g_control_mutex);
+    controller_boot_mark("position restore", &stage_us);
 }
 
-void controller_calibrate(void)
+esp_err_t controller_add_state_callback(controller_state_callback_t callback, void *user_data)
 {
-    ESP_LOGI(TAG, "Starting calibration mode");
-    g_config.state = CALIBRATING;
-    controller_stop();
+    if (callback == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
 
-    // Получаем callback для описания шагов калибровки
-    g_calibration_callback = position_sensor_start_calibration();
+    portENTER_CRITICAL(&g_callback_lock);
+    bool full = g_state_callback_count >= STATE_CALLBACKS_MAX;
+    if (!full)
+    {
+        g_state_callbacks[g_state_callback_count].callback = callback;
+        g_state_callbacks[g_state_callback_count].user_data = user_data;
+        g_state_callback_count++;
+    }
+    portEXIT_CRITICAL(&g_callback_lock);
 
-    if (g_calibration_callback)
+    if (full)
     {
-        calibration_step_t current_step = position_sensor_next_calibration_step();
-        const char *description = g_calibration_callback(current_step);
-        ESP_LOGI(TAG, "Calibration step %d: %s", current_step, description);
+        ESP_LOGE(TAG, "Too many state callbacks");
+        return ESP_ERR_NO_MEM;
     }
+    return ESP_OK;
 }
 
-void controller_goto_top(void)
+esp_err_t controller_add_position_callback(controller_position_callback_t callback, void *user_data)
 {
-    if (position_sensor_is_calibrated())
+    if (callback == NULL)
     {
-        // Получаем реальную минимальную позицию из position_sensor
-        uint32_t min_pos = position_sensor_get_min_position();
-        ESP_LOGI(TAG, "Moving to top position: %lu", min_pos);
-        controller_move_to_position(min_pos);
+        return ESP_ERR_INVALID_ARG;
     }
-    else
+
+    portENTER_CRITICAL(&g_callback_lock);
+    bool full = g_position_callback_count >= STATE_CALLBACKS_MAX;
+    if (!full)
     {
-        ESP_LOGW(TAG, "Not calibrated, cannot goto top");
+        g_position_callbacks[g_position_callback_count].callback = callback;
+        g_position_callbacks[g_position_callback_count].user_data = user_data;
+        g_position_callback_count++;
+    }
+    portEXIT_CRITICAL(&g_callback_lock);
+
+    if (full)
+    {
+        ESP_LOGE(TAG, "Too many position callbacks");
+        return ESP_ERR_NO_MEM;
     }
+    return ESP_OK;
 }
 
-void controller_goto_bottom(void)
+static void controller_notify_position(shade_t *s, bool settled)
 {
-    if (position_sensor_is_calibrated())
+    portENTER_CRITICAL(&g_callback_lock);
+    uint8_t count = g_position_callback_count;
+    portEXIT_CRITICAL(&g_callback_lock);
+
+    if (count == 0)
     {
-        // Получаем реальную максимальную позицию из position_sensor
-        uint32_t max_pos = position_sensor_get_max_position();
-        ESP_LOGI(TAG, "Moving to bottom position: %lu", max_pos);
-        controller_move_to_position(max_pos);
+        return;
     }
-    else
+
+    float percentage = controller_get_position_percentage(s->id);
+    for (uint8_t i = 0; i < count; i++)
     {
-        ESP_LOGW(TAG, "Not calibrated, cannot goto bottom");
+        g_position_callbacks[i].callback(s->id, percentage, settled, g_position_callbacks[i].user_data);
     }
 }
 
-state_t controller_get_state(void)
+static void controller_notify_state(shade_t *s)
 {
-    return g_config.state;
-}
+    portENTER_CRITICAL(&g_callback_lock);
+    uint8_t count = g_state_callback_count;
+    portEXIT_CRITICAL(&g_callback_lock);
 
-bool controller_is_moving(void)
-{
-    return motor_is_moving();
+    for (uint8_t i = 0; i < count; i++)
+    {
+        g_state_callbacks[i].callback(s->id, s->config.state, s->fault, g_state_callbacks[i].user_data);
+    }
 }
 
-void controller_set_position_percentage(float percentage)
+static void controller_set_state(shade_t *s, state_t state)
 {
-    if (percentage < 0.0f)
-        percentage = 0.0f;
-    if (percentage > 100.0f)
-        percentage = 100.0f;
+    if (s->config.state == state)
+    {
+        return;
+    }
 
-    if (position_sensor_is_calibrated())
+    // Любая смена состояния после неисправности считается ее подтверждением.
+    // Остановка во время калибровки оставляет состояние CALIBRATING, поэтому
+    // неисправность снимается и при выходе из калибровки, а не только из FAULT
+    if (s->fault != CONTROLLER_FAULT_NONE)
     {
-        uint32_t current_pos = position_sensor_read();
-        float current_percentage = position_sensor_get_percentage();
+        ESP_LOGI(TAG, "Shade %u: fault cleared: %s", s->id + 1, controller_fault_to_string(s->fault));
+        s->fault = CONTROLLER_FAULT_NONE;
+    }
 
-        // Получаем реальные границы из position_sensor
-        uint32_t min_pos = position_sensor_get_min_position();
-        uint32_t max_pos = position_sensor_get_max_position();
-        uint32_t range = max_pos - min_pos;
-        uint32_t target_position = min_pos + (uint32_t)(range * percentage / 100.0f);
+    s->config.state = state;
+    controller_notify_state(s);
+}
 
-        ESP_LOGI(TAG, "Setting position %.1f%% (ADC: %lu, range: %lu-%lu)",
-                 percentage, target_position, min_pos, max_pos);
+static void controller_raise_fault(shade_t *s, controller_fault_t fault)
+{
+    ESP_LOGE(TAG, "Shade %u: fault: %s", s->id + 1, controller_fault_to_string(fault));
+
+    s->monitor.active = false;
+    motor_stop(s->id);
+
+    s->fault = fault;
 
-        controller_move_to_position(target_position);
+    // Калибровку не прерываем: пользователь может переставить штору
+    if (s->config.state != CALIBRATING)
+    {
+        s->config.state = FAULT;
     }
-    else
+    controller_notify_state(s);
+}
+
+controller_fault_t controller_get_fault(uint8_t shade)
+{
+    return g_shades[shade].fault;
+}
+
+const char *controller_fault_to_string(controller_fault_t fault)
+{
+    switch (fault)
     {
-        ESP_LOGW(TAG, "Not calibrated, cannot set position percentage");
+    case CONTROLLER_FAULT_NONE:
+        return "none";
+    case CONTROLLER_FAULT_STALL:
+        return "stall";
+    default:
+        return "unknown";
     }
 }
 
-static void controller_button_callback(button_event_t event, button_id_t button_id, void *user_data)
+esp_reset_reason_t controller_get_reset_reason(void)
 {
-    ESP_LOGI(TAG, "Button event: %d, button_id: %d", event, button_id);
+    return g_reset_reason;
+}
 
+static void controller_motor_event_callback(uint8_t shade, motor_event_t event, int32_t position_steps)
+{
+    // Вызывается из контекста таймера шагов: только обновление записи в RTC
+    // памяти и пробуждение задачи наблюдения. Смена скорости по зонам - в ней
+    shade_t *s = &g_shades[shade];
     switch (event)
     {
-    case BUTTON_EVENT_SIMULTANEOUS_PRESS:
-        if (g_config.state == CALIBRATING)
+    case MOTOR_EVENT_SEGMENT:
+        s->record->position_steps = position_steps;
+        s->record->checksum = motion_record_checksum(s);
+        if (g_monitor_task != NULL)
         {
-            // Выход из режима калибровки
-            ESP_LOGI(TAG, "Exiting calibration mode");
-            g_config.state = IDLE;
-            g_calibration_callback = NULL;
-            controller_stop();
+            xTaskNotify(g_monitor_task, MONITOR_EVENT_SEGMENT(shade), eSetBits);
         }
-        else
+        break;
+
+    case MOTOR_EVENT_STOPPED:
+        motion_record_clear(s, position_steps);
+        if (g_monitor_task != NULL)
         {
-            // Вход в режим калибровки
-            controller_calibrate();
+            xTaskNotify(g_monitor_task, MONITOR_EVENT_STOPPED(shade), eSetBits);
         }
         break;
+    }
+}
 
-    case BUTTON_SINGLE_CLICK:
-        if (g_config.state == CALIBRATING && g_calibration_callback)
-        {
-            // Сохраняем текущую позицию для шага калибровки
-            uint32_t current_position = position_sensor_read();
-            position_sensor_save_calibration_step(current_position);
+static void controller_save_reset_reason(void)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open("controller", NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error opening NVS: %s", esp_err_to_name(err));
+        return;
+    }
 
-            // Переходим к следующему шагу
-            calibration_step_t next_step = position_sensor_next_calibration_step();
+    uint32_t interrupted_moves = 0;
+    nvs_get_u32(nvs_handle, "interrupted", &interrupted_moves);
+    nvs_set_u32(nvs_handle, "interrupted", interrupted_moves + 1);
+    nvs_set_u32(nvs_handle, "reset_reason", (uint32_t)g_reset_reason);
+    nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+}
 
-            if (next_step == CALIBRATION_STEP_COMPLETE)
-            {
-                // Калибровка завершена
-                ESP_LOGI(TAG, "Calibration completed");
-                g_config.state = IDLE;
-                g_calibration_callback = NULL;
-                controller_stop();
-            }
-            else
-            {
-                // Показываем описание следующего шага
-                const char *description = g_calibration_callback(next_step);
-                ESP_LOGI(TAG, "Calibration step %d: %s", next_step, description);
-            }
-        }
-        else
-        {
-            // Одиночное нажатие - переход в крайнее положение
-            if (button_id == BUTTON_ID_UP)
-            {
-                controller_goto_top();
-            }
-            else if (button_id == BUTTON_ID_DOWN)
-            {
-                controller_goto_bottom();
-            }
-        }
-        break;
+static void controller_resume_interrupted_move(shade_t *s)
+{
+    if (g_reset_reason == ESP_RST_POWERON || !motion_record_is_valid(s))
+    {
+        // После включения питания содержимое RTC памяти не определено
+        controller_sync_position_steps(s);
+        motion_record_clear(s, motor_get_position_steps(s->id));
+        return;
+    }
 
-    case BUTTON_DOUBLE_CLICK:
-        if (g_config.state != CALIBRATING)
-        {
-            // Двойное нажатие
-#ifdef CONFIG_ZEBRA_BLINDS_SUPPORT
-            if (position_sensor_is_calibrated())
-            {
-                uint32_t zebra_offset = position_sensor_get_zebra_offset();
-                if (zebra_offset > 0)
-                {
-                    // Выполнение откалиброванного смещения для штор зебра
-                    controller_handle_zebra_offset();
-                    break;
-                }
-            }
-#else
-            // Переход на позицию 50%
-            controller_set_position_percentage(50.0f);
-#endif
-        }
-        break;
+    // Шаговая позиция точнее АЦП, восстанавливаем ее в любом случае
+    motor_set_position_steps(s->id, s->record->position_steps);
 
-    case BUTTON_LONG_PRESS_START:
-        if (g_config.state != CALIBRATING)
-        {
-            // Движение пока кнопка удерживается
-            g_button_held = true;
-            if (button_id == BUTTON_ID_UP)
-            {
-                controller_move_up();
-            }
-            else if (button_id == BUTTON_ID_DOWN)
-            {
-                controller_move_down();
-            }
+    if (s->record->mode == MOTION_RECORD_NONE)
+    {
+        return;
+    }
 
-            // Запускаем задачу проверки границ
-            if (g_boundary_check_task == NULL)
-            {
-                xTaskCreate(boundary_check_task, "boundary_check", 2048, NULL, 10, &g_boundary_check_task);
-            }
-        }
-        break;
+    ESP_LOGW(TAG, "Shade %u: move interrupted by reset (reason %d), mode %lu, target %ld, steps %ld",
+             s->id + 1, g_reset_reason, s->record->mode, s->record->target_steps,
+             s->record->position_steps);
+    controller_save_reset_reason();
 
-    case BUTTON_PRESS_UP:
-        if (g_button_held)
-        {
-            // Остановка движения при отпускании кнопки
-            controller_stop();
-        }
-        break;
+    s->record->resume_attempts++;
+    s->record->checksum = motion_record_checksum(s);
 
-    default:
-        break;
+    if (s->record->resume_attempts > CONFIG_CONTROLLER_RESUME_MAX_ATTEMPTS)
+    {
+        // Питание не держит нагрузку мотора - прекращаем попытки
+        ESP_LOGE(TAG, "Resume failed %lu times, giving up", s->record->resume_attempts - 1);
+        motion_record_clear(s, s->record->position_steps);
+        return;
+    }
+
+    if (s->record->mode == MOTION_RECORD_TARGET)
+    {
+        ESP_LOGI(TAG, "Shade %u: resuming move to %ld steps (attempt %lu)",
+                 s->id + 1, s->record->target_steps, s->record->resume_attempts);
+        controller_move_to_steps(s, s->record->target_steps, NULL);
+    }
+    else
+    {
+        // Непрерывное движение без удерживаемой кнопки не возобновляем: мотор уже обесточен
+        ESP_LOGI(TAG, "Finishing interrupted continuous move");
+        motion_record_clear(s, s->record->position_steps);
     }
 }
 
-#ifdef CONFIG_ZEBRA_BLINDS_SUPPORT
-static void controller_handle_zebra_offset(void)
+void controller_move_to_position(uint8_t shade, uint32_t position)
 {
-    if (!position_sensor_is_calibrated())
+    controller_move_to_position_limited(&g_shades[shade], position, NULL);
+}
+
+static void controller_move_to_position_limited(shade_t *s, uint32_t position, const controller_move_limits_t *limits)
+{
+    if (s->config.state == CALIBRATING)
     {
-        ESP_LOGW(TAG, "Not calibrated, cannot handle zebra offset");
+        ESP_LOGW(TAG, "Cannot move to position during calibration");
         return;
     }
 
-    uint32_t zebra_offset = position_sensor_get_zebra_offset();
-    if (zebra_offset == 0)
+    uint32_t current_pos = position_sensor_read(s->id);
+
+    if (current_pos == position)
     {
-        ESP_LOGW(TAG, "Zebra offset not configured");
+        ESP_LOGI(TAG, "Already at target position: %lu", position);
         return;
     }
 
-    // Вычисляем целевую позицию с учетом смещения
-    uint32_t current_pos = position_sensor_read();
-    uint32_t target_pos;
-
-    // Получаем границы из position_sensor (нужно будет добавить функции)
-    uint32_t min_pos = 0;    // position_sensor_get_min_position();
-    uint32_t max_pos = 4095; // position_sensor_get_max_position();
+    ESP_LOGI(TAG, "Moving from position %lu to %lu", current_pos, position);
 
-    // Определяем direction на основе текущей позиции
-    if (current_pos <= min_pos + zebra_offset)
+    int32_t target_steps;
+    if (controller_has_step_calibration(s))
     {
-        // Двигаемся вниз на смещение
-        target_pos = current_pos + zebra_offset;
+        target_steps = controller_position_to_steps(s, position);
     }
-    else if (current_pos >= max_pos - zebra_offset)
+    else
     {
-        // Двигаемся вверх на смещение
-        target_pos = current_pos - zebra_offset;
+        // Без калибровки хода считаем разницу АЦП количеством шагов (упрощенный подход)
+        target_steps = motor_get_position_steps(s->id) + (int32_t)position - (int32_t)current_pos;
     }
-    else
+
+    controller_move_to_steps(s, target_steps, limits);
+
+    s->config.position.current_position = position;
+
+    // Проверяем границы сразу после запуска движения
+    controller_check_boundaries_and_stop(s);
+}
+
+// Наибольшая скорость движения на steps шагов с учетом ограничений, 0 - без ограничения
+static uint32_t controller_limit_speed(uint32_t steps, const controller_move_limits_t *limits)
+{
+    if (limits == NULL)
     {
-        // Чередуем направление движения
-        static bool last_direction_up = false;
-        if (last_direction_up)
-        {
-            target_pos = current_pos - zebra_offset;
-        }
-        else
+        return 0;
+    }
+
+    uint32_t max_speed = limits->speed;
+    if (limits->transition_ms != 0)
+    {
+        // Разгон и торможение только удлиняют движение, поэтому оценка по интервалу шага достаточна
+        uint32_t interval_us = (uint32_t)((uint64_t)limits->transition_ms * 1000 / steps);
+        uint32_t transition_speed = motor_speed_for_step_interval(interval_us);
+        if (max_speed == 0 || transition_speed < max_speed)
         {
-            target_pos = current_pos + zebra_offset;
+            max_speed = transition_speed;
         }
-        last_direction_up = !last_direction_up;
     }
+    return max_speed;
+}
+
+// Движение к позиции в шагах за один проход
+static void controller_move_to_steps(shade_t *s, int32_t target_steps, const controller_move_limits_t *limits)
+{
+    int32_t current_steps = motor_get_position_steps(s->id);
+
+    if (current_steps == target_steps)
+    {
+        ESP_LOGI(TAG, "Already at target: %ld steps", target_steps);
+        return;
+    }
+
+    // Определяем направление на основе текущей и целевой позиций
+    motor_direction_t direction = (target_steps > current_steps
+                                       ? MOTOR_DIR_DOWN
+                                       : MOTOR_DIR_UP);
+    uint32_t steps = (uint32_t)(target_steps > current_steps ? target_steps - current_steps
+                                                             : current_steps - target_steps);
+
+    ESP_LOGI(TAG, "Shade %u: moving from %ld to %ld steps", s->id + 1, current_steps, target_steps);
+
+    // Запускаем движение мотора
+    motion_record_begin(s, MOTION_RECORD_TARGET, direction, target_steps);
+    s->monitor_restart = true;
+    motion_planner_move_limited(s->id, direction, steps, controller_limit_speed(steps, limits));
 
-    // Ограничиваем целевую позицию в пределах диапазона
-    if (target_pos < min_pos)
+    // Обновляем состояние
+    if (direction == MOTOR_DIR_UP)
     {
-        target_pos = min_pos;
+        controller_set_state(s, MOVING_UP);
     }
-    else if (target_pos > max_pos)
+    else
     {
-        target_pos = max_pos;
+        controller_set_state(s, MOVING_DOWN);
     }
-
-    ESP_LOGI(TAG, "Moving to zebra offset position: %lu", target_pos);
-    controller_move_to_position(target_pos);
 }
-#endif
 
-// Функция проверки границ и автоматической остановки
-static bool controller_check_boundaries_and_stop(void)
+// Непрерывное движение до остановки, в том числе во время калибровки.
+// jog - ручное движение с постепенным разгоном
+static void controller_start_continuous(shade_t *s, motor_direction_t direction, bool jog)
 {
-    if (!position_sensor_is_calibrated())
+    motion_record_begin(s, MOTION_RECORD_CONTINUOUS, direction, 0);
+    s->monitor_restart = true;
+    if (jog)
     {
-        return false; // Нет калибровки - не проверяем границы
+        motion_planner_jog(s->id, direction);
+    }
+    else
+    {
+        // Большое количество шагов для непрерывного движения
+        motion_planner_move(s->id, direction, UINT32_MAX);
     }
 
-    uint32_t current_pos = position_sensor_read();
-    uint32_t min_pos = position_sensor_get_min_position();
-    uint32_t max_pos = position_sensor_get_max_position();
+    if (s->config.state != CALIBRATING)
+    {
+        controller_set_state(s, (direction == MOTOR_DIR_UP) ? MOVING_UP : MOVING_DOWN);
+    }
+}
 
-    // Проверяем достижение границы
-    if (current_pos <= min_pos || current_pos >= max_pos)
+void controller_move_up(uint8_t shade)
+{
+    shade_t *s = &g_shades[shade];
+    if (s->config.state == CALIBRATING)
     {
-        ESP_LOGI(TAG, "%s boundary reached: %lu", current_pos >= max_pos ? "Lower" : "current_pos >= max_pos", current_pos);
-        controller_stop();
-        return true;
+        ESP_LOGW(TAG, "Cannot move up during calibration");
+        return;
     }
 
-    return false;
+    ESP_LOGI(TAG, "Shade %u: moving up", shade + 1);
+    controller_start_continuous(s, MOTOR_DIR_UP, false);
 }
 
-// Периодическая задача для проверки границ при удержании кнопки
-static void boundary_check_task(void *parameter)
+void controller_move_down(uint8_t shade)
 {
-    while (g_button_held && motor_is_moving())
+    shade_t *s = &g_shades[shade];
+    if (s->config.state == CALIBRATING)
     {
-        // Проверяем границы каждые 100 мс
-        if (controller_check_boundaries_and_stop())
-        {
-            break; // Вышли из цикла, так как достигли границы
-        }
-        vTaskDelay(pdMS_TO_TICKS(100));
+        ESP_LOGW(TAG, "Cannot move down during calibration");
+        return;
     }
 
-    // Задача завершается, когда кнопка отпущена или мотор остановлен
-    g_boundary_check_task = NULL;
-    vTaskDelete(NULL);
+    ESP_LOGI(TAG, "Shade %u: moving down", shade + 1);
+    controller_start_continuous(s, MOTOR_DIR_DOWN, false);
+}
+
+void controller_stop(uint8_t shade)
+{
+    shade_t *s = &g_shades[shade];
+    ESP_LOGI(TAG, "Shade %u: stopping motor", shade + 1);
+
+    // Проверяем, движется ли мотор
+    if (motor_is_moving(s->id))
+    {
+        ESP_LOGI(TAG, "Motor is moving, stopping");
+        motor_stop(s->id);
+    }
+    else
+    {
+        ESP_LOGD(TAG, "Motor already stopped");
+    }
+
+    controller_set_state(s, IDLE);
+    s->button_held = false;
+}
+
+void controller_calibrate(uint8_t shade)
+{
+    shade_t *s = &g_shades[shade];
+    ESP_LOGI(TAG, "Shade %u: starting calibration mode", shade + 1);
+    controller_stop(s->id);
+    controller_set_state(s, CALIBRATING);
+
+    // Получаем callback для описания шагов калибровки
+    s->calibration_callback = position_sensor_start_calibration(s->id);
+
+    if (s->calibration_callback)
+    {
+        calibration_step_t current_step = position_sensor_get_calibration_step(s->id);
+        const char *description = s->calibration_callback(current_step);
+        ESP_LOGI(TAG, "Calibration step %d: %s", current_step, description);
+    }
+}
+
+void controller_goto_top(uint8_t shade)
+{
+    if (position_sensor_is_calibrated(shade))
+    {
+        // Получаем реальную минимальную позицию из position_sensor
+        uint32_t min_pos = position_sensor_get_min_position(shade);
+        ESP_LOGI(TAG, "Shade %u: moving to top position: %lu", shade + 1, min_pos);
+        controller_move_to_position(shade, min_pos);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Not calibrated, cannot goto top");
+    }
+}
+
+void controller_goto_bottom(uint8_t shade)
+{
+    if (position_sensor_is_calibrated(shade))
+    {
+        // Получаем реальную максимальную позицию из position_sensor
+        uint32_t max_pos = position_sensor_get_max_position(shade);
+        ESP_LOGI(TAG, "Shade %u: moving to bottom position: %lu", shade + 1, max_pos);
+        controller_move_to_position(shade, max_pos);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Not calibrated, cannot goto bottom");
+    }
+}
+
+// Переход к следующему шагу калибровки
+static void controller_advance_calibration(shade_t *s)
+{
+    calibration_step_t next_step = position_sensor_next_calibration_step(s->id);
+
+    if (next_step == CALIBRATION_STEP_COMPLETE)
+    {
+        // Калибровка завершена
+        ESP_LOGI(TAG, "Shade %u: calibration completed", s->id + 1);
+        motion_planner_set_travel_steps(s->id, position_sensor_get_travel_steps(s->id));
+        controller_set_state(s, IDLE);
+        s->calibration_callback = NULL;
+        controller_stop(s->id);
+        return;
+    }
+
+    // Показываем описание следующего шага
+    if (s->calibration_callback)
+    {
+        const char *description = s->calibration_callback(next_step);
+        ESP_LOGI(TAG, "Calibration step %d: %s", next_step, description);
+    }
+
+    if (next_step == CALIBRATION_STEP_BACKLASH)
+    {
+        // Измерение выполняется автоматически, шаг завершается задачей измерения
+        xTaskCreate(backlash_measure_task, "backlash_measure", 3072, s, 5, NULL);
+    }
+}
+
+static void controller_wait_motor_idle(shade_t *s)
+{
+    while (motor_is_moving(s->id))
+    {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+// Порция движения измерения. Мьютекс держится только на запуск: калибровку
+// могут прервать остановкой, пока мотор идет
+static bool controller_backlash_move(shade_t *s, motor_direction_t direction, uint32_t steps)
+{
+    xSemaphoreTake(g_control_mutex, portMAX_DELAY);
+    bool calibrating = s->config.state == CALIBRATING;
+    if (calibrating)
+    {
+        motion_planner_move(s->id, direction, steps);
+    }
+    xSemaphoreGive(g_control_mutex);
+
+    controller_wait_motor_idle(s);
+    return calibrating;
+}
+
+// Измерение люфта по плато АЦП в начале реверса. Возвращает false, если движение
+// шторы не обнаружено
+static bool controller_measure_backlash(shade_t *s, uint32_t *backlash_steps)
+{
+    // Нагружаем редуктор в направлении вверх
+    motion_planner_set_backlash_steps(s->id, 0);
+    if (!controller_backlash_move(s, MOTOR_DIR_UP, BACKLASH_MAX_STEPS))
+    {
+        return false;
+    }
+
+    uint32_t baseline = position_sensor_read_raw(s->id);
+
+    // Реверс вниз небольшими порциями: пока выбирается люфт, АЦП не меняется
+    uint32_t probed_steps = 0;
+    bool moved = false;
+    while (probed_steps < 2 * BACKLASH_MAX_STEPS)
+    {
+        if (!controller_backlash_move(s, MOTOR_DIR_DOWN, BACKLASH_PROBE_STEPS))
+        {
+            break;
+        }
+        probed_steps += BACKLASH_PROBE_STEPS;
+
+        if (position_sensor_read_raw(s->id) >= baseline + BACKLASH_ADC_THRESHOLD)
+        {
+            moved = true;
+            break;
+        }
+    }
+
+    if (!moved)
+    {
+        return false;
+    }
+
+    // Вычитаем шаги, за которые штора проходит пороговое изменение АЦП
+    uint32_t motion_steps = 0;
+    uint32_t range = position_sensor_get_max_position(s->id) - position_sensor_get_min_position(s->id);
+    if (range > 0)
+    {
+        motion_steps = BACKLASH_ADC_THRESHOLD * position_sensor_get_travel_steps(s->id) / range;
+    }
+
+    *backlash_steps = probed_steps > motion_steps ? probed_steps - motion_steps : 0;
+    return true;
+}
+
+// parameter - штора, для которой идет калибровка
+static void backlash_measure_task(void *parameter)
+{
+    shade_t *s = (shade_t *)parameter;
+    uint32_t previous = position_sensor_get_backlash_steps(s->id);
+    uint32_t backlash = previous;
+
+    ESP_LOGI(TAG, "Shade %u: measuring backlash", s->id + 1);
+    if (controller_measure_backlash(s, &backlash))
+    {
+        ESP_LOGI(TAG, "Backlash measured: %lu steps", backlash);
+        position_sensor_set_backlash_steps(s->id, backlash);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Backlash measurement failed, keeping %lu steps", previous);
+    }
+
+    xSemaphoreTake(g_control_mutex, portMAX_DELAY);
+    motion_planner_set_backlash_steps(s->id, backlash);
+    if (s->config.state == CALIBRATING)
+    {
+        controller_advance_calibration(s);
+    }
+    xSemaphoreGive(g_control_mutex);
+
+    vTaskDelete(NULL);
+}
+
+state_t controller_get_state(uint8_t shade)
+{
+    return g_shades[shade].config.state;
+}
+
+bool controller_is_moving(uint8_t shade)
+{
+    return motor_is_moving(shade);
+}
+
+float controller_get_position_percentage(uint8_t shade)
+{
+    shade_t *s = &g_shades[shade];
+    // Шаговая позиция точнее АЦП и не требует чтения датчика на ходу
+    if (controller_has_step_calibration(s))
+    {
+        int32_t steps = motor_get_position_steps(s->id);
+        int32_t travel = (int32_t)position_sensor_get_travel_steps(s->id);
+
+        if (steps <= 0)
+            return 0.0f;
+        if (steps >= travel)
+            return 100.0f;
+        return steps * 100.0f / travel;
+    }
+
+    return position_sensor_get_percentage(s->id);
+}
+
+float controller_get_target_percentage(uint8_t shade)
+{
+    shade_t *s = &g_shades[shade];
+    if (!motor_is_moving(s->id) || !controller_has_step_calibration(s))
+    {
+        return controller_get_position_percentage(s->id);
+    }
+
+    // Непрерывное движение идет до крайнего положения
+    if (s->record->mode != MOTION_RECORD_TARGET)
+    {
+        return motor_get_direction(s->id) == MOTOR_DIR_UP ? 0.0f : 100.0f;
+    }
+
+    int32_t travel = (int32_t)position_sensor_get_travel_steps(s->id);
+    int32_t target = s->record->target_steps;
+
+    if (target <= 0)
+        return 0.0f;
+    if (target >= travel)
+        return 100.0f;
+    return target * 100.0f / travel;
+}
+
+void controller_set_position_percentage(uint8_t shade, float percentage)
+{
+    controller_set_position_percentage_limited(shade, percentage, NULL);
+}
+
+void controller_set_position_percentage_limited(uint8_t shade, float percentage, const controller_move_limits_t *limits)
+{
+    shade_t *s = &g_shades[shade];
+    if (percentage < 0.0f)
+        percentage = 0.0f;
+    if (percentage > 100.0f)
+        percentage = 100.0f;
+
+    if (position_sensor_is_calibrated(s->id))
+    {
+        uint32_t current_pos = position_sensor_read(s->id);
+        float current_percentage = position_sensor_get_percentage(s->id);
+
+        // Получаем реальные границы из position_sensor
+        uint32_t min_pos = position_sensor_get_min_position(s->id);
+        uint32_t max_pos = position_sensor_get_max_position(s->id);
+        uint32_t range = max_pos - min_pos;
+        uint32_t target_position = min_pos + (uint32_t)(range * percentage / 100.0f);
+
+        ESP_LOGI(TAG, "Setting position %.1f%% (ADC: %lu, range: %lu-%lu)",
+                 percentage, target_position, min_pos, max_pos);
+
+        controller_move_to_position_limited(s, target_position, limits);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Not calibrated, cannot set position percentage");
+    }
+}
+
+// Вызывается из задачи esp_timer: только постановка события в очередь контроллера
+static void controller_button_callback(const button_event_msg_t *msg, void *user_data)
+{
+    command_msg_t command = {};
+    command.kind = COMMAND_GESTURE;
+    command.gesture = *msg;
+
+    if (g_command_queue == NULL || xQueueSend(g_command_queue, &command, 0) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Command queue full, gesture action %d dropped", msg->action);
+    }
+}
+
+esp_err_t controller_post_work(controller_work_t work, void *arg)
+{
+    if (work == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (g_command_queue == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    command_msg_t command = {};
+    command.kind = COMMAND_WORK;
+    command.work.fn = work;
+    command.work.arg = arg;
+
+    if (xQueueSend(g_command_queue, &command, 0) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Command queue full, work dropped");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t controller_post_request(const controller_request_t *request)
+{
+    if (request == NULL || request->shade >= CONFIG_SHADE_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (g_command_queue == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    command_msg_t command = {};
+    command.kind = COMMAND_REQUEST;
+    command.request = *request;
+
+    if (xQueueSend(g_command_queue, &command, 0) != pdTRUE)
+    {
+        ESP_LOGW(TAG, "Command queue full, request %d dropped", request->kind);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static void controller_handle_request(const controller_request_t *request)
+{
+    uint8_t shade = request->shade;
+
+    switch (request->kind)
+    {
+    case CONTROLLER_REQUEST_STOP:
+        controller_stop(shade);
+        break;
+    case CONTROLLER_REQUEST_MOVE_UP:
+        controller_move_up(shade);
+        break;
+    case CONTROLLER_REQUEST_MOVE_DOWN:
+        controller_move_down(shade);
+        break;
+    case CONTROLLER_REQUEST_POSITION:
+        controller_set_position_percentage_limited(shade, request->percentage, &request->limits);
+        break;
+    case CONTROLLER_REQUEST_TILT:
+        controller_zebra_set_tilt_percentage(shade, request->percentage);
+        break;
+    }
+}
+
+static void controller_record_press_latency(const button_event_msg_t *msg, int64_t handled_us)
+{
+    // Учитываем только движение, запущенное обработкой этого события. При
+    // управлении всеми шторами - по первому запущенному мотору
+    int64_t start_us = INT64_MAX;
+    for (uint8_t shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        int64_t shade_start_us = motor_get_start_time_us(shade);
+        if (motor_is_moving(shade) && shade_start_us >= handled_us && shade_start_us < start_us)
+        {
+            start_us = shade_start_us;
+        }
+    }
+    if (start_us == INT64_MAX)
+    {
+        return;
+    }
+
+    int64_t latency_us = start_us - msg->press_time_us;
+    g_press_latency.count++;
+    g_press_latency.total_us += latency_us;
+    if (latency_us > g_press_latency.max_us)
+    {
+        g_press_latency.max_us = latency_us;
+    }
+
+    ESP_LOGI(TAG, "Press-to-motor-start latency: %lld us (avg %lld us, max %lld us, n=%lu)",
+             latency_us, g_press_latency.total_us / g_press_latency.count,
+             g_press_latency.max_us, g_press_latency.count);
+}
+
+static void controller_task(void *parameter)
+{
+    command_msg_t command;
+
+    while (true)
+    {
+        if (xQueueReceive(g_command_queue, &command, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+
+        xSemaphoreTake(g_control_mutex, portMAX_DELAY);
+        if (command.kind == COMMAND_WORK)
+        {
+            command.work.fn(command.work.arg);
+        }
+        else if (command.kind == COMMAND_REQUEST)
+        {
+            controller_handle_request(&command.request);
+        }
+        else
+        {
+            int64_t handled_us = esp_timer_get_time();
+            controller_handle_gesture(&command.gesture);
+            controller_record_press_latency(&command.gesture, handled_us);
+        }
+        xSemaphoreGive(g_control_mutex);
+    }
+}
+
+static void gesture_calibrate(shade_t *s)
+{
+    if (s->config.state == CALIBRATING)
+    {
+        // Выход из режима калибровки
+        ESP_LOGI(TAG, "Shade %u: exiting calibration mode", s->id + 1);
+        controller_set_state(s, IDLE);
+        s->calibration_callback = NULL;
+        controller_stop(s->id);
+    }
+    else
+    {
+        // Вход в режим калибровки
+        controller_calibrate(s->id);
+    }
+}
+
+// Одиночное нажатие во время калибровки подтверждает текущую точку
+static bool gesture_confirm_calibration_point(shade_t *s)
+{
+    if (s->config.state != CALIBRATING || !s->calibration_callback)
+    {
+        return false;
+    }
+
+    // Верхняя точка - начало отсчета шагов
+    if (position_sensor_get_calibration_step(s->id) == CALIBRATION_STEP_UPPER)
+    {
+        motor_set_position_steps(s->id, 0);
+    }
+
+    // Во время измерения люфта нажатия игнорируются
+    if (position_sensor_get_calibration_step(s->id) == CALIBRATION_STEP_BACKLASH)
+    {
+        return true;
+    }
+
+    // Сохраняем текущую позицию для шага калибровки
+    uint32_t current_position = position_sensor_read(s->id);
+    position_sensor_save_calibration_step(s->id, current_position, motor_get_position_steps(s->id));
+
+    // Переходим к следующему шагу
+    controller_advance_calibration(s);
+    return true;
+}
+
+static void gesture_goto_top(shade_t *s)
+{
+    if (!gesture_confirm_calibration_point(s))
+    {
+        controller_goto_top(s->id);
+    }
+}
+
+static void gesture_goto_bottom(shade_t *s)
+{
+    if (!gesture_confirm_calibration_point(s))
+    {
+        controller_goto_bottom(s->id);
+    }
+}
+
+static void gesture_preset(shade_t *s)
+{
+    if (s->config.state == CALIBRATING)
+    {
+        return;
+    }
+
+#ifdef CONFIG_ZEBRA_BLINDS_SUPPORT
+    // Переключение между совмещенными и перекрытыми полосами за одно движение
+    controller_zebra_align(s->id, controller_zebra_current_alignment(s) == ZEBRA_STRIPES_OPEN
+                               ? ZEBRA_STRIPES_CLOSED
+                               : ZEBRA_STRIPES_OPEN);
+#else
+    // Переход на позицию 50%
+    controller_set_position_percentage(s->id, 50.0f);
+#endif
+}
+
+// Движение с разгоном пока кнопка удерживается. Во время калибровки так
+// выставляются точки калибровки, границы при этом не проверяются
+static void gesture_jog_up(shade_t *s)
+{
+    s->button_held = true;
+    controller_start_continuous(s, MOTOR_DIR_UP, true);
+}
+
+static void gesture_jog_down(shade_t *s)
+{
+    s->button_held = true;
+    controller_start_continuous(s, MOTOR_DIR_DOWN, true);
+}
+
+static void gesture_stop(shade_t *s)
+{
+    if (!s->button_held)
+    {
+        return;
+    }
+
+    // Плавная остановка при отпускании кнопки. Состояние IDLE выставит
+    // монитор движения по событию остановки мотора
+    s->button_held = false;
+    motion_planner_stop(s->id);
+}
+
+// Обработчики действий в порядке gesture_action_t, вызываются для каждой
+// шторы, которой управляют кнопки
+typedef void (*gesture_handler_t)(shade_t *s);
+
+static const gesture_handler_t g_gesture_handlers[] = {
+    NULL,                // GESTURE_ACTION_NONE
+    gesture_calibrate,   // GESTURE_ACTION_CALIBRATE
+    gesture_goto_top,    // GESTURE_ACTION_GOTO_TOP
+    gesture_goto_bottom, // GESTURE_ACTION_GOTO_BOTTOM
+    gesture_preset,      // GESTURE_ACTION_PRESET
+    gesture_jog_up,      // GESTURE_ACTION_JOG_UP
+    gesture_jog_down,    // GESTURE_ACTION_JOG_DOWN
+    gesture_stop,        // GESTURE_ACTION_STOP
+    NULL,                // GESTURE_ACTION_SELECT_SHADE - controller_select_button_shade
+};
+
+static_assert(sizeof(g_gesture_handlers) / sizeof(g_gesture_handlers[0]) == GESTURE_ACTION_COUNT,
+              "g_gesture_handlers must cover every gesture_action_t");
+
+static bool controller_any_calibrating(void)
+{
+    for (uint8_t shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        if (g_shades[shade].config.state == CALIBRATING)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Переключение кнопок по кругу: штора 1, 2, ..., все шторы
+static void controller_select_button_shade(void)
+{
+    // Во время калибровки нажатия подтверждают точки калиброванной шторы
+    if (controller_any_calibrating())
+    {
+        ESP_LOGW(TAG, "Cannot switch shades during calibration");
+        return;
+    }
+
+    g_button_shade = (g_button_shade + 1) % (CONFIG_SHADE_COUNT + 1);
+    if (g_button_shade == CONFIG_SHADE_COUNT)
+    {
+        ESP_LOGI(TAG, "Buttons control all shades");
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Buttons control shade %u", g_button_shade + 1);
+    }
+}
+
+static void controller_handle_gesture(const button_event_msg_t *msg)
+{
+    ESP_LOGI(TAG, "Gesture action: %d, buttons: 0x%x", msg->action, msg->buttons);
+
+    if (msg->action == GESTURE_ACTION_SELECT_SHADE)
+    {
+        controller_select_button_shade();
+        return;
+    }
+
+    if (msg->action >= GESTURE_ACTION_COUNT || g_gesture_handlers[msg->action] == NULL)
+    {
+        return;
+    }
+
+    if (g_button_shade < CONFIG_SHADE_COUNT)
+    {
+        g_gesture_handlers[msg->action](&g_shades[g_button_shade]);
+        return;
+    }
+
+    // Калибровка идет для одной шторы: ее точки выставляются кнопками по отдельности
+    if (msg->action == GESTURE_ACTION_CALIBRATE)
+    {
+        ESP_LOGW(TAG, "Select a single shade to calibrate");
+        return;
+    }
+
+    for (uint8_t shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        g_gesture_handlers[msg->action](&g_shades[shade]);
+    }
+}
+
+#ifdef CONFIG_ZEBRA_BLINDS_SUPPORT
+// Ближайшее к текущей позиции положение с заданным смещением внутри периода полос
+static int32_t controller_zebra_nearest(shade_t *s, int32_t current_steps, uint32_t offset_steps)
+{
+    int32_t period = (int32_t)position_sensor_get_zebra_period_steps(s->id);
+    int32_t travel = (int32_t)position_sensor_get_travel_steps(s->id);
+    int32_t base = (int32_t)(position_sensor_get_zebra_phase_steps(s->id) + offset_steps) % period;
+
+    // Округление к ближайшему кратному периоду
+    int32_t delta = current_steps - base + period / 2;
+    int32_t k = delta >= 0 ? delta / period : -((-delta + period - 1) / period);
+    int32_t target = base + k * period;
+
+    // Оставляем цель в пределах хода шторы
+    if (target > travel)
+        target -= period;
+    if (target < 0)
+        target += period;
+    if (target > travel)
+        target = travel;
+
+    return target;
+}
+
+static bool controller_zebra_is_calibrated(shade_t *s)
+{
+    if (!controller_has_step_calibration(s) || position_sensor_get_zebra_period_steps(s->id) == 0)
+    {
+        ESP_LOGW(TAG, "Zebra stripes not calibrated");
+        return false;
+    }
+    return true;
+}
+
+static zebra_alignment_t controller_zebra_current_alignment(shade_t *s)
+{
+    if (!controller_zebra_is_calibrated(s))
+    {
+        return ZEBRA_STRIPES_CLOSED;
+    }
+
+    int32_t current = motor_get_position_steps(s->id);
+    int32_t to_open = controller_zebra_nearest(s, current, 0) - current;
+    int32_t to_closed = controller_zebra_nearest(s, current, position_sensor_get_zebra_period_steps(s->id) / 2) - current;
+
+    return abs(to_open) <= abs(to_closed) ? ZEBRA_STRIPES_OPEN : ZEBRA_STRIPES_CLOSED;
+}
+
+void controller_zebra_set_tilt_percentage(uint8_t shade, float percentage)
+{
+    shade_t *s = &g_shades[shade];
+    if (s->config.state == CALIBRATING)
+    {
+        ESP_LOGW(TAG, "Cannot tilt during calibration");
+        return;
+    }
+
+    if (!controller_zebra_is_calibrated(s))
+    {
+        return;
+    }
+
+    if (percentage < 0.0f)
+        percentage = 0.0f;
+    if (percentage > 100.0f)
+        percentage = 100.0f;
+
+    // Совмещенное и перекрытое положения отстоят на половину периода
+    uint32_t half_period = position_sensor_get_zebra_period_steps(s->id) / 2;
+    uint32_t offset = (uint32_t)(half_period * percentage / 100.0f);
+    int32_t target_steps = controller_zebra_nearest(s, motor_get_position_steps(s->id), offset);
+
+    ESP_LOGI(TAG, "Zebra tilt %.1f%%: moving to %ld steps", percentage, target_steps);
+    controller_move_to_steps(s, target_steps, NULL);
+}
+
+void controller_zebra_align(uint8_t shade, zebra_alignment_t alignment)
+{
+    controller_zebra_set_tilt_percentage(shade, alignment == ZEBRA_STRIPES_OPEN ? 0.0f : 100.0f);
+}
+#else
+void controller_zebra_align(uint8_t shade, zebra_alignment_t alignment)
+{
+    ESP_LOGW(TAG, "Zebra blinds support is disabled");
+}
+
+void controller_zebra_set_tilt_percentage(uint8_t shade, float percentage)
+{
+    ESP_LOGW(TAG, "Zebra blinds support is disabled");
+}
+#endif
+
+// Функция проверки границ и автоматической остановки
+static bool controller_check_boundaries_and_stop(shade_t *s)
+{
+    if (!position_sensor_is_calibrated(s->id) || s->config.state == CALIBRATING)
+    {
+        return false; // Нет калибровки - не проверяем границы
+    }
+
+    uint32_t current_pos = position_sensor_read(s->id);
+    uint32_t min_pos = position_sensor_get_min_position(s->id);
+    uint32_t max_pos = position_sensor_get_max_position(s->id);
+    motor_direction_t direction = motor_get_direction(s->id);
+
+    // Проверяем достижение границы только в направлении движения
+    if ((direction == MOTOR_DIR_UP && current_pos <= min_pos) ||
+        (direction == MOTOR_DIR_DOWN && current_pos >= max_pos))
+    {
+        ESP_LOGI(TAG, "Shade %u: %s boundary reached: %lu", s->id + 1,
+                 direction == MOTOR_DIR_DOWN ? "lower" : "upper", current_pos);
+        controller_stop(s->id);
+        return true;
+    }
+
+    return false;
+}
+
+// Проверка остановки: мотор шагает, а датчик почти не меняется
+static bool controller_check_stall(shade_t *s, int32_t steps, uint32_t adc)
+{
+    // Плато АЦП при измерении люфта - ожидаемое поведение
+    if (s->config.state == CALIBRATING && position_sensor_get_calibration_step(s->id) == CALIBRATION_STEP_BACKLASH)
+    {
+        return false;
+    }
+
+    int32_t commanded = abs(steps - s->monitor.stall_steps);
+    if (commanded < CONFIG_MOTOR_STALL_WINDOW_STEPS)
+    {
+        return false;
+    }
+
+    uint32_t measured = adc > s->monitor.stall_adc ? adc - s->monitor.stall_adc : s->monitor.stall_adc - adc;
+
+    // Ожидаемое изменение АЦП за окно по калибровке хода
+    uint32_t expected = STALL_UNCALIBRATED_MIN_COUNTS * 100 / CONFIG_MOTOR_STALL_MIN_MOTION_PERCENT;
+    if (controller_has_step_calibration(s))
+    {
+        uint32_t range = position_sensor_get_max_position(s->id) - position_sensor_get_min_position(s->id);
+        expected = (uint32_t)((uint64_t)commanded * range / position_sensor_get_travel_steps(s->id));
+    }
+
+    s->monitor.stall_steps = steps;
+    s->monitor.stall_adc = adc;
+
+    if (measured * 100 >= expected * CONFIG_MOTOR_STALL_MIN_MOTION_PERCENT)
+    {
+        return false;
+    }
+
+    ESP_LOGE(TAG, "Shade %u: stall detected: %ld steps, ADC changed by %lu (expected %lu)", s->id + 1, commanded, measured, expected);
+    controller_raise_fault(s, CONTROLLER_FAULT_STALL);
+    return true;
+}
+
+// Выполняется в задаче контроллера после проскальзывания. Движение могли
+// остановить или сменить, пока работа ждала в очереди. arg - штора
+static void controller_replan_after_slip(void *arg)
+{
+    shade_t *s = (shade_t *)arg;
+    if (s->record->mode != MOTION_RECORD_TARGET || !motor_is_moving(s->id))
+    {
+        return;
+    }
+
+    // Перепланирование продолжает то же движение: проскальзывание не забывается
+    bool restart = s->monitor_restart;
+    controller_move_to_steps(s, s->record->target_steps, NULL);
+    s->monitor_restart = restart;
+}
+
+// Проверка проскальзывания: сравнение пройденных шагов с перемещением по АЦП
+static void controller_check_slip(shade_t *s, int32_t steps, uint32_t adc)
+{
+    if (!controller_has_step_calibration(s) || s->config.state == CALIBRATING)
+    {
+        return;
+    }
+
+    int32_t sensor_steps = controller_position_to_steps(s, adc);
+    int32_t commanded = abs(steps - s->monitor.window_steps);
+    if (commanded < CONFIG_MOTOR_SLIP_WINDOW_STEPS)
+    {
+        return;
+    }
+
+    // Перемещение по датчику в направлении движения
+    int32_t measured = sensor_steps - s->monitor.window_sensor_steps;
+    if (s->monitor.direction == MOTOR_DIR_UP)
+    {
+        measured = -measured;
+    }
+
+    s->monitor.window_steps = steps;
+    s->monitor.window_sensor_steps = sensor_steps;
+
+    if (measured * 100 >= commanded * (100 - CONFIG_MOTOR_SLIP_TOLERANCE_PERCENT))
+    {
+        return;
+    }
+
+    ESP_LOGW(TAG, "Shade %u: slip detected: commanded %ld steps, measured %ld steps", s->id + 1, commanded, measured);
+    s->monitor.slipped = true;
+    motion_planner_report_slip(s->id, s->monitor.direction, steps);
+
+    // Счетчик шагов ушел от реального положения - синхронизируем по датчику
+    motor_set_position_steps(s->id, sensor_steps);
+    s->monitor.window_steps = sensor_steps;
+    s->monitor.stall_steps = sensor_steps;
+
+    // Движение к цели перепланируем с пониженной скоростью. Команды движения
+    // выполняет только задача контроллера
+    if (s->record->mode == MOTION_RECORD_TARGET)
+    {
+        controller_post_work(controller_replan_after_slip, s);
+    }
+}
+
+static void controller_monitor_segment(shade_t *s)
+{
+    if (!motor_is_moving(s->id) || controller_check_boundaries_and_stop(s))
+    {
+        return;
+    }
+
+    int32_t steps = motor_get_position_steps(s->id);
+    uint32_t adc = position_sensor_read_raw(s->id);
+
+    if (s->monitor_restart || !s->monitor.active)
+    {
+        // Новое движение: начинаем первые окна сравнения
+        s->monitor_restart = false;
+        s->monitor.active = true;
+        s->monitor.direction = motor_get_direction(s->id);
+        s->monitor.start_steps = steps;
+        s->monitor.window_steps = steps;
+        s->monitor.window_sensor_steps = controller_has_step_calibration(s) ? controller_position_to_steps(s, adc) : 0;
+        s->monitor.stall_steps = steps;
+        s->monitor.stall_adc = adc;
+        s->monitor.slipped = false;
+        return;
+    }
+
+    if (controller_check_stall(s, steps, adc))
+    {
+        return;
+    }
+
+    controller_check_slip(s, steps, adc);
+}
+
+static void controller_monitor_finish(shade_t *s)
+{
+    if (s->monitor.active && !s->monitor.slipped && !s->monitor_restart)
+    {
+        motion_planner_report_clean_travel(s->id, s->monitor.direction, s->monitor.start_steps,
+                                           motor_get_position_steps(s->id));
+    }
+    s->monitor.active = false;
+    motion_planner_finish(s->id);
+}
+
+static void motion_monitor_task(void *parameter)
+{
+    uint32_t events;
+
+    while (true)
+    {
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+        xSemaphoreTake(g_control_mutex, portMAX_DELAY);
+
+        for (uint8_t shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+        {
+            shade_t *s = &g_shades[shade];
+
+            if (events & MONITOR_EVENT_SEGMENT(shade))
+            {
+                if (motor_is_moving(shade))
+                {
+                    motion_planner_update(shade, motor_get_position_steps(shade));
+                }
+                controller_monitor_segment(s);
+                if (motor_is_moving(shade))
+                {
+                    controller_notify_position(s, false);
+                }
+            }
+
+            if ((events & MONITOR_EVENT_STOPPED(shade)) && !motor_is_moving(shade))
+            {
+                controller_monitor_finish(s);
+
+                // Движение к цели завершилось само
+                if (s->config.state == MOVING_UP || s->config.state == MOVING_DOWN)
+                {
+                    controller_set_state(s, IDLE);
+                }
+
+                controller_notify_position(s, true);
+            }
+        }
+
+        xSemaphoreGive(g_control_mutex);
+    }
 }
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "esp_system.h"
 #include "position_sensor.h"
 #include "motor_control.h"
 #include "button_handler.h"
@@ -18,9 +19,59 @@ extern "C"
         MOVING_UP,
         MOVING_DOWN,
         CALIBRATING,
-        EMERGENCY_STOP
+        EMERGENCY_STOP,
+        FAULT
     } state_t;
 
+    // Причина перехода в состояние FAULT
+    typedef enum
+    {
+        CONTROLLER_FAULT_NONE,
+        CONTROLLER_FAULT_STALL // Мотор шагает, а датчик положения не меняется
+    } controller_fault_t;
+
+    // Уведомление о смене состояния шторы shade. Вызывается из задачи, сменившей состояние
+    typedef void (*controller_state_callback_t)(uint8_t shade, state_t state, controller_fault_t fault, void *user_data);
+
+    // Уведомление о позиции (0% - верх, 100% - низ): на каждом сегменте движения
+    // и после остановки (settled). Вызывается из задачи наблюдения за движением
+    typedef void (*controller_position_callback_t)(uint8_t shade, float percentage, bool settled, void *user_data);
+
+    // Совмещение полос штор зебра
+    typedef enum
+    {
+        ZEBRA_STRIPES_OPEN,  // Полосы совмещены, максимальный просвет
+        ZEBRA_STRIPES_CLOSED // Полосы перекрывают друг друга
+    } zebra_alignment_t;
+
+    // Работа, выполняемая в задаче контроллера
+    typedef void (*controller_work_t)(void *arg);
+
+    // Ограничения движения по команде, 0 - без ограничения
+    typedef struct
+    {
+        uint8_t speed;          // Наибольшая скорость 1-100
+        uint32_t transition_ms; // Время движения до цели
+    } controller_move_limits_t;
+
+    // Команда управления от внешних источников (MQTT, Matter)
+    typedef enum
+    {
+        CONTROLLER_REQUEST_STOP,
+        CONTROLLER_REQUEST_MOVE_UP,
+        CONTROLLER_REQUEST_MOVE_DOWN,
+        CONTROLLER_REQUEST_POSITION, // percentage и limits
+        CONTROLLER_REQUEST_TILT      // percentage
+    } controller_request_kind_t;
+
+    typedef struct
+    {
+        controller_request_kind_t kind;
+        uint8_t shade;    // Номер шторы с нуля
+        float percentage; // 0% - верх (для наклона - полосы совмещены)
+        controller_move_limits_t limits;
+    } controller_request_t;
+
     typedef struct
     {
         state_t state;
@@ -28,17 +79,44 @@ extern "C"
         bool auto_calibrate;
     } config_t;
 
+    // Контроллер управляет всеми шторами платы (CONFIG_SHADE_COUNT), shade - номер шторы с нуля
     void controller_init(void);
-    void controller_move_to_position(uint32_t position);
-    void controller_move_up(void);
-    void controller_move_down(void);
-    void controller_stop(void);
-    void controller_calibrate(void);
-    void controller_goto_top(void);
-    void controller_goto_bottom(void);
-    void controller_set_position_percentage(float percentage);
-    state_t controller_get_state(void);
-    bool controller_is_moving(void);
+    // Команды движения меняют состояние контроллера и вызываются только из его
+    // задачи: из обработчиков кнопок и работы controller_post_work. Остальные
+    // задачи отправляют команду через controller_post_request
+    void controller_move_to_position(uint8_t shade, uint32_t position);
+    void controller_move_up(uint8_t shade);
+    void controller_move_down(uint8_t shade);
+    void controller_stop(uint8_t shade);
+    void controller_calibrate(uint8_t shade);
+    void controller_goto_top(uint8_t shade);
+    void controller_goto_bottom(uint8_t shade);
+    void controller_set_position_percentage(uint8_t shade, float percentage);
+    // Движение к позиции с ограничением скорости или времени перехода
+    void controller_set_position_percentage_limited(uint8_t shade, float percentage, const controller_move_limits_t *limits);
+    void controller_zebra_align(uint8_t shade, zebra_alignment_t alignment);
+    // Наклон зебры: 0% - полосы совмещены, 100% - перекрыты
+    void controller_zebra_set_tilt_percentage(uint8_t shade, float percentage);
+    state_t controller_get_state(uint8_t shade);
+    bool controller_is_moving(uint8_t shade);
+    float controller_get_position_percentage(uint8_t shade);
+    // Цель текущего движения; в покое совпадает с текущей позицией
+    float controller_get_target_percentage(uint8_t shade);
+
+    // Постановка работы в очередь команд контроллера, вместе с событиями кнопок.
+    // Не блокирует: для задачи esp_timer и обработчиков, которым нельзя ждать мотор
+    esp_err_t controller_post_work(controller_work_t work, void *arg);
+
+    // Постановка команды в ту же очередь. Команда копируется, не блокирует
+    esp_err_t controller_post_request(const controller_request_t *request);
+
+    esp_err_t controller_add_state_callback(controller_state_callback_t callback, void *user_data);
+    esp_err_t controller_add_position_callback(controller_position_callback_t callback, void *user_data);
+    controller_fault_t controller_get_fault(uint8_t shade);
+    const char *controller_fault_to_string(controller_fault_t fault);
+
+    // Причина последнего сброса, определенная при инициализации
+    esp_reset_reason_t controller_get_reset_reason(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,111 @@
+// components/button_handler/gesture_map.h
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "button_handler.h"
+
+// Максимальное число нажатий в одном жесте
+#define GESTURE_MAX_CLICKS 3
+
+// Привязка жеста к действию
+typedef struct
+{
+    uint8_t buttons;                 // Набор кнопок (BUTTON_MASK_*), несколько кнопок - аккорд
+    uint8_t clicks;                  // Число нажатий, включая последнее
+    bool hold;                       // Последнее нажатие удерживается
+    uint16_t hold_ms;                // Время удержания для hold
+    gesture_action_t action;         // Действие при распознавании жеста
+    gesture_action_t release_action; // Действие при отпускании после удержания
+} gesture_binding_t;
+
+#define GESTURE_CLICK(buttons, clicks, action) \
+    {(buttons), (clicks), false, 0, (action), GESTURE_ACTION_NONE}
+#define GESTURE_HOLD(buttons, clicks, action, release_action) \
+    {(buttons), (clicks), true, CONFIG_BUTTON_LONG_PRESS_MS, (action), (release_action)}
+
+// Таблица жестов. Новые жесты (тройное нажатие, нажатие с удержанием,
+// аккорд с удержанием) добавляются сюда без изменения автомата
+inline constexpr gesture_binding_t GESTURE_MAP[] = {
+    GESTURE_CLICK(BUTTON_MASK_UP, 1, GESTURE_ACTION_GOTO_TOP),
+    GESTURE_CLICK(BUTTON_MASK_DOWN, 1, GESTURE_ACTION_GOTO_BOTTOM),
+    GESTURE_CLICK(BUTTON_MASK_UP, 2, GESTURE_ACTION_PRESET),
+    GESTURE_CLICK(BUTTON_MASK_DOWN, 2, GESTURE_ACTION_PRESET),
+    GESTURE_HOLD(BUTTON_MASK_UP, 1, GESTURE_ACTION_JOG_UP, GESTURE_ACTION_STOP),
+    GESTURE_HOLD(BUTTON_MASK_DOWN, 1, GESTURE_ACTION_JOG_DOWN, GESTURE_ACTION_STOP),
+    GESTURE_CLICK(BUTTON_MASK_BOTH, 1, GESTURE_ACTION_CALIBRATE),
+#if CONFIG_SHADE_COUNT > 1
+    // Двойное нажатие обеих кнопок переключает штору, которой управляют кнопки
+    GESTURE_CLICK(BUTTON_MASK_BOTH, 2, GESTURE_ACTION_SELECT_SHADE),
+#endif
+};
+
+#define GESTURE_NO_BINDING 0xFF
+
+// Таблица переходов автомата, собираемая из GESTURE_MAP при компиляции
+typedef struct
+{
+    // Индекс привязки в GESTURE_MAP по [набор кнопок][число нажатий][удержание]
+    uint8_t binding[BUTTON_MASK_BOTH + 1][GESTURE_MAX_CLICKS + 1][2];
+    // Наибольшее число нажатий для набора кнопок - после него жест завершается сразу
+    uint8_t max_clicks[BUTTON_MASK_BOTH + 1];
+    // Кнопка входит в какой-либо аккорд - до окончания окна аккорда жест не завершается
+    bool chord_possible[BUTTON_MASK_BOTH + 1];
+} gesture_table_t;
+
+constexpr gesture_table_t gesture_compile(void)
+{
+    gesture_table_t table = {};
+
+    for (auto &by_mask : table.binding)
+        for (auto &by_clicks : by_mask)
+            for (auto &entry : by_clicks)
+                entry = GESTURE_NO_BINDING;
+
+    for (size_t i = 0; i < sizeof(GESTURE_MAP) / sizeof(GESTURE_MAP[0]); i++)
+    {
+        const gesture_binding_t &b = GESTURE_MAP[i];
+        table.binding[b.buttons][b.clicks][b.hold] = (uint8_t)i;
+        if (b.clicks > table.max_clicks[b.buttons])
+            table.max_clicks[b.buttons] = b.clicks;
+        if (b.buttons == BUTTON_MASK_BOTH)
+        {
+            table.chord_possible[BUTTON_MASK_UP] = true;
+            table.chord_possible[BUTTON_MASK_DOWN] = true;
+        }
+    }
+
+    return table;
+}
+
+// Проверка таблицы при компиляции
+constexpr bool gesture_map_valid(void)
+{
+    constexpr size_t count = sizeof(GESTURE_MAP) / sizeof(GESTURE_MAP[0]);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const gesture_binding_t &a = GESTURE_MAP[i];
+        if (a.buttons == 0 || a.buttons > BUTTON_MASK_BOTH)
+            return false;
+        if (a.clicks == 0 || a.clicks > GESTURE_MAX_CLICKS)
+            return false;
+        if (a.action >= GESTURE_ACTION_COUNT || a.release_action >= GESTURE_ACTION_COUNT)
+            return false;
+        if (!a.hold && a.release_action != GESTURE_ACTION_NONE)
+            return false;
+
+        // Один жест - одно действие
+        for (size_t j = i + 1; j < count; j++)
+        {
+            const gesture_binding_t &b = GESTURE_MAP[j];
+            if (a.buttons == b.buttons && a.clicks == b.clicks && a.hold == b.hold)
+                return false;
+        }
+    }
+
+    return count < GESTURE_NO_BINDING;
+}
+
+static_assert(gesture_map_valid(), "GESTURE_MAP contains an invalid or duplicate gesture");
@@ -1,7 +1,12 @@
 #include "controller.h"
+#include "power_management.h"
 #include "esp_log.h"
 #include "esp_err.h"
 #include "nvs_flash.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
 
 // Условные включения интеграций
 #ifdef CONFIG_ENABLE_MATTER_INTEGRATION
@@ -12,9 +17,91 @@
 #include "mqtt_integration.h"
 #endif
 
+#ifdef CONFIG_WIFI_STATION
+#include "wifi_station.h"
+#endif
+
+#if defined(CONFIG_ENABLE_MATTER_INTEGRATION) || defined(CONFIG_ENABLE_MQTT_INTEGRATION)
+#define BOOT_NETWORK_STAGES_ENABLED
+#include "esp_netif.h"
+#include "esp_event.h"
+#endif
+
+static const char *TAG = "main";
+
+// Этап загрузки, выполняемый в своей задаче параллельно с остальными
+typedef struct
+{
+    const char *name;
+    void (*init)(void);
+    uint32_t stack_size;
+    EventBits_t done_bit;
+} boot_stage_t;
+
+static void boot_mark(const char *stage, int64_t start_us)
+{
+    int64_t now_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "Boot: %s ready at %lld ms (took %lld ms)", stage, now_us / 1000, (now_us - start_us) / 1000);
+}
+
+#ifdef BOOT_NETWORK_STAGES_ENABLED
+static EventGroupHandle_t g_boot_events = NULL;
+
+static void boot_stage_task(void *arg)
+{
+    const boot_stage_t *stage = (const boot_stage_t *)arg;
+    int64_t start_us = esp_timer_get_time();
+
+    stage->init();
+
+    boot_mark(stage->name, start_us);
+    xEventGroupSetBits(g_boot_events, stage->done_bit);
+    vTaskDelete(NULL);
+}
+
+#ifdef CONFIG_ENABLE_MQTT_INTEGRATION
+static void boot_mqtt_init(void)
+{
+    esp_err_t err = mqtt_integration_init();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "MQTT integration failed: %s", esp_err_to_name(err));
+    }
+}
+#endif
+
+#ifdef CONFIG_WIFI_STATION
+static void boot_wifi_init(void)
+{
+    esp_err_t err = wifi_station_init();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Wi-Fi station failed: %s", esp_err_to_name(err));
+    }
+}
+#endif
+
+// Сетевые стеки поднимаются в фоне, независимо друг от друга
+static const boot_stage_t BOOT_NETWORK_STAGES[] = {
+#ifdef CONFIG_ENABLE_MATTER_INTEGRATION
+    {"Matter", matter_integration_init, 8192, BIT0},
+#endif
+#ifdef CONFIG_WIFI_STATION
+    {"Wi-Fi", boot_wifi_init, 4096, BIT2},
+#endif
+#ifdef CONFIG_ENABLE_MQTT_INTEGRATION
+    {"MQTT", boot_mqtt_init, 4096, BIT1},
+#endif
+};
+#endif
+
 extern "C" void app_main()
 {
-    // Инициализация NVS (обязательно для хранения ключей Matter и других данных)
+    // Время загрузки считается от сброса: esp_timer запускается до app_main
+    int64_t boot_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "Boot: app_main at %lld ms", boot_us / 1000);
+
+    // Этап 1. NVS: нужна и калибровке, и ключам Matter
     esp_err_t err = nvs_flash_init();
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
     {
@@ -22,28 +109,48 @@ extern "C" void app_main()
         err = nvs_flash_init();
     }
     ESP_ERROR_CHECK(err);
+    boot_mark("NVS", boot_us);
 
-    // Инициализация компонентов
-    ESP_LOGI("main", "Initializing controller...");
-    controller_init();
-
-#ifdef CONFIG_ENABLE_MATTER_INTEGRATION
-    // Инициализация Matter интеграции
-    ESP_LOGI("main", "Initializing Matter integration...");
-    matter_integration_init();
-#endif
+    // Частота и легкий сон настраиваются до создания блокировок питания модулями
+    power_management_init();
 
-#ifdef CONFIG_ENABLE_MQTT_INTEGRATION
-    // Инициализация MQTT интеграции
-    ESP_LOGI("main", "Initializing MQTT integration...");
-    mqtt_integration_init();
-#endif
+    // Этап 2. Местное управление: мотор, калибровка, кнопки. Готово до сетевых
+    // стеков, чтобы прерванное сбросом движение возобновилось как можно раньше
+    int64_t stage_us = esp_timer_get_time();
+    controller_init();
+    boot_mark("local control", stage_us);
 
-    ESP_LOGI("main", "Shade ready");
+#ifdef BOOT_NETWORK_STAGES_ENABLED
+    // Этап 3. Общая сетевая основа создается один раз до параллельного запуска стеков
+    stage_us = esp_timer_get_time();
+    ESP_ERROR_CHECK(esp_netif_init());
+    err = esp_event_loop_create_default();
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
+    {
+        ESP_ERROR_CHECK(err);
+    }
+    boot_mark("network core", stage_us);
 
-    while (1)
+    // Этап 4. Сетевые стеки в фоне
+    g_boot_events = xEventGroupCreate();
+    EventBits_t all_bits = 0;
+    for (size_t i = 0; i < sizeof(BOOT_NETWORK_STAGES) / sizeof(BOOT_NETWORK_STAGES[0]); i++)
     {
-        // Интеграции обрабатываются через события
-        vTaskDelay(pdMS_TO_TICKS(1000));
+        const boot_stage_t *stage = &BOOT_NETWORK_STAGES[i];
+        if (xTaskCreate(boot_stage_task, stage->name, stage->stack_size, (void *)stage, 5, NULL) != pdPASS)
+        {
+            ESP_LOGE(TAG, "Failed to start %s stage", stage->name);
+            continue;
+        }
+        all_bits |= stage->done_bit;
     }
+
+    ESP_LOGI(TAG, "Shade ready, network stacks starting in background");
+
+    // Интеграции обрабатываются через события; задача app_main нужна только для итога загрузки
+    xEventGroupWaitBits(g_boot_events, all_bits, pdFALSE, pdTRUE, portMAX_DELAY);
+    boot_mark("all stages", boot_us);
+#else
+    ESP_LOGI(TAG, "Shade ready");
+#endif
 }
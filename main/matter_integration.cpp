@@ -1,23 +1,481 @@
 #include "matter_integration.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_matter.h>
+#include <platform/CHIPDeviceLayer.h>
+#include <app/clusters/scenes-server/SceneHandlerImpl.h>
+#include <app/clusters/scenes-server/scenes-server.h>
+#include <app/InteractionModelEngine.h>
+#include <stdlib.h>
+#include <app-common/zap-generated/ids/Attributes.h>
+#include <app-common/zap-generated/ids/Clusters.h>
 
 #if CHIP_DEVICE_CONFIG_ENABLE_THREAD
 #include <platform/ESP32/OpenthreadLauncher.h>
 #endif
 
+#if CHIP_CONFIG_ENABLE_ICD_SERVER
+#include <app/icd/server/ICDNotifier.h>
+#endif
+
 using namespace esp_matter;
 using namespace esp_matter::cluster;
 using namespace esp_matter::endpoint;
+using namespace chip::app::Clusters;
+
+static const char *TAG = "matter_integration";
+
+// OperationalStatus: биты 0-1 - общее движение, биты 2-3 - подъем
+#define OPERATIONAL_STATUS_OPENING 0x05
+#define OPERATIONAL_STATUS_CLOSING 0x0A
+
+// Состояние шторы для отчетов. Заполняется задачами контроллера
+typedef struct
+{
+    uint16_t current_100ths;
+    uint16_t target_100ths;
+    uint8_t operational_status;
+    bool urgent; // Старт, остановка или конечная позиция - без ограничения частоты
+} matter_report_t;
+
+// Эндпоинт Window Covering на каждую штору платы
+typedef struct
+{
+    uint16_t endpoint_id;
+    matter_report_t report; // Под g_report_lock
+    // Значения в кластере. Доступны только из потока CHIP
+    uint16_t reported_current;
+    uint16_t reported_target;
+    uint8_t reported_status;
+} matter_shade_t;
+
+static matter_shade_t g_shades[CONFIG_SHADE_COUNT];
+
+// Отчеты всех эндпоинтов переносятся в кластеры одним пакетом в потоке CHIP,
+// ограничение частоты общее: шторы, движущиеся вместе, не умножают трафик
+static portMUX_TYPE g_report_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t g_report_timer = NULL;
+static bool g_report_urgent = false;    // Ожидает срочный отчет
+static bool g_report_scheduled = false; // Перенос в кластеры уже запланирован
+static int64_t g_reported_time_us = 0;  // Время последнего отчета о позиции
+// Идет собственное обновление атрибутов: обратный вызов не должен считать его командой
+static bool g_updating_attributes = false;
+
+// Время загрузки: этапы отмечаются один раз, от сброса (esp_timer считает с загрузки)
+static bool g_boot_server_ready = false;
+static bool g_boot_first_update = false;
+static bool g_boot_first_subscription = false;
+
+static uint16_t matter_percent100ths(float percentage)
+{
+    if (percentage <= 0.0f)
+        return 0;
+    if (percentage >= 100.0f)
+        return 10000;
+    return (uint16_t)(percentage * 100.0f + 0.5f);
+}
+
+// Штора по номеру эндпоинта, -1 - эндпоинт не штора
+static int matter_shade_by_endpoint(uint16_t endpoint_id)
+{
+    for (int shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        if (g_shades[shade].endpoint_id == endpoint_id)
+        {
+            return shade;
+        }
+    }
+    return -1;
+}
+
+static void matter_update_attribute(uint16_t endpoint_id, uint32_t attribute_id, esp_matter_attr_val_t *val)
+{
+    esp_err_t err = attribute::update(endpoint_id, WindowCovering::Id, attribute_id, val);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to update attribute 0x%lx: %s", attribute_id, esp_err_to_name(err));
+    }
+}
+
+// Перенос состояния одной шторы в кластер. Возвращает true, если отправлена позиция
+static bool matter_apply_report(matter_shade_t *shade, const matter_report_t *report)
+{
+    // На ходу мелкие изменения позиции не стоят отдельного отчета по Thread
+    int delta = abs((int)report->current_100ths - (int)shade->reported_current);
+    bool position_due = report->urgent ? delta != 0 : delta >= CONFIG_MATTER_REPORT_MIN_DELTA;
+
+    if (report->operational_status != shade->reported_status)
+    {
+        esp_matter_attr_val_t val = esp_matter_bitmap8(report->operational_status);
+        matter_update_attribute(shade->endpoint_id, WindowCovering::Attributes::OperationalStatus::Id, &val);
+        shade->reported_status = report->operational_status;
+    }
+
+    if (report->target_100ths != shade->reported_target)
+    {
+        esp_matter_attr_val_t val = esp_matter_nullable_uint16(report->target_100ths);
+        matter_update_attribute(shade->endpoint_id, WindowCovering::Attributes::TargetPositionLiftPercent100ths::Id,
+                                &val);
+        shade->reported_target = report->target_100ths;
+    }
+
+    if (position_due)
+    {
+        esp_matter_attr_val_t val = esp_matter_nullable_uint16(report->current_100ths);
+        matter_update_attribute(shade->endpoint_id, WindowCovering::Attributes::CurrentPositionLiftPercent100ths::Id,
+                                &val);
+        shade->reported_current = report->current_100ths;
+    }
+
+    return position_due;
+}
+
+// Перенос состояния всех штор в кластеры. Выполняется в потоке CHIP
+static void matter_report_work(intptr_t arg)
+{
+    matter_report_t reports[CONFIG_SHADE_COUNT];
+
+    portENTER_CRITICAL(&g_report_lock);
+    for (int shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        reports[shade] = g_shades[shade].report;
+        g_shades[shade].report.urgent = false;
+    }
+    g_report_urgent = false;
+    g_report_scheduled = false;
+    portEXIT_CRITICAL(&g_report_lock);
+
+    g_updating_attributes = true;
+
+    bool position_reported = false;
+    bool active = false;
+    for (int shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        position_reported |= matter_apply_report(&g_shades[shade], &reports[shade]);
+        active |= reports[shade].operational_status != 0 || reports[shade].urgent;
+    }
+
+    g_updating_attributes = false;
+
+    if (position_reported)
+    {
+        portENTER_CRITICAL(&g_report_lock);
+        g_reported_time_us = esp_timer_get_time();
+        portEXIT_CRITICAL(&g_report_lock);
+    }
+
+    // Отметка первого обновления атрибутов в кластере. Подписчику оно уходит
+    // позже, по графику отчетов Interaction Model
+    if (g_boot_server_ready && !g_boot_first_update)
+    {
+        g_boot_first_update = true;
+        ESP_LOGI(TAG, "Boot: first attribute update at %lld ms", esp_timer_get_time() / 1000);
+    }
+
+#if CHIP_CONFIG_ENABLE_ICD_SERVER
+    // Спящее устройство: движение держит его в активном режиме с частым опросом
+    // родителя, чтобы команда остановки и отчеты о позиции доходили без задержки.
+    // После остановки устройство возвращается к редкому опросу через
+    // CONFIG_ICD_ACTIVE_MODE_THRESHOLD_MS. Ввод в сеть стек удерживает сам
+    if (active)
+    {
+        chip::app::ICDNotifier::GetInstance().NotifyNetworkActivityNotification();
+    }
+#endif
+}
+
+static void matter_schedule_report(void)
+{
+    if (chip::DeviceLayer::PlatformMgr().ScheduleWork(matter_report_work, 0) != CHIP_NO_ERROR)
+    {
+        portENTER_CRITICAL(&g_report_lock);
+        g_report_scheduled = false;
+        portEXIT_CRITICAL(&g_report_lock);
+        ESP_LOGW(TAG, "Failed to schedule attribute report");
+    }
+}
+
+// Отложенный отчет о позиции на ходу
+static void matter_report_timer_cb(void *arg)
+{
+    matter_schedule_report();
+}
+
+// Новое состояние для кластера. Срочное уходит сразу, позиция на ходу -
+// не чаще CONFIG_MATTER_REPORT_MIN_INTERVAL_MS; все изменения за интервал
+// сливаются в один пакет
+static void matter_report(uint8_t shade, state_t state, float position, bool urgent)
+{
+    uint8_t status = 0;
+    if (state == MOVING_UP)
+        status = OPERATIONAL_STATUS_OPENING;
+    else if (state == MOVING_DOWN)
+        status = OPERATIONAL_STATUS_CLOSING;
+
+    uint16_t target_100ths = matter_percent100ths(controller_get_target_percentage(shade));
+
+    portENTER_CRITICAL(&g_report_lock);
+    matter_report_t *report = &g_shades[shade].report;
+    report->current_100ths = matter_percent100ths(position);
+    report->target_100ths = target_100ths;
+    report->operational_status = status;
+    report->urgent |= urgent;
+    bool schedule_now = urgent && !g_report_urgent;
+    bool schedule_later = !g_report_scheduled;
+    int64_t reported_time_us = g_reported_time_us;
+    g_report_urgent |= urgent;
+    g_report_scheduled = true;
+    portEXIT_CRITICAL(&g_report_lock);
+
+    if (schedule_now)
+    {
+        // Ожидающий отчет на ходу уходит вместе со срочным
+        esp_timer_stop(g_report_timer);
+        matter_schedule_report();
+    }
+    else if (schedule_later)
+    {
+        int64_t elapsed_us = esp_timer_get_time() - reported_time_us;
+        int64_t delay_us = (int64_t)CONFIG_MATTER_REPORT_MIN_INTERVAL_MS * 1000 - elapsed_us;
+        if (delay_us <= 0)
+        {
+            matter_schedule_report();
+        }
+        else
+        {
+            esp_timer_start_once(g_report_timer, (uint64_t)delay_us);
+        }
+    }
+}
+
+static void matter_controller_state_cb(uint8_t shade, state_t state, controller_fault_t fault, void *user_data)
+{
+    matter_report(shade, state, controller_get_position_percentage(shade), true);
+}
+
+static void matter_controller_position_cb(uint8_t shade, float percentage, bool settled, void *user_data)
+{
+    matter_report(shade, controller_get_state(shade), percentage, settled);
+}
+
+static void matter_report_all(void)
+{
+    for (uint8_t shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        matter_integration_update_state(shade, controller_get_state(shade), controller_get_position_percentage(shade));
+    }
+}
 
 void app_event_cb(const ChipDeviceEvent *event, intptr_t arg)
 {
+    switch (event->Type)
+    {
+    case chip::DeviceLayer::DeviceEventType::kServerReady:
+        // К этому моменту сервер восстановил сохраненные подписки и начал
+        // их возобновление через CASE сессии с контроллерами
+        g_boot_server_ready = true;
+        ESP_LOGI(TAG, "Boot: Matter server ready at %lld ms", esp_timer_get_time() / 1000);
+        matter_report_all();
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Первая подписка после загрузки - новая или возобновленная
+class ShadeReadHandlerCallback : public chip::app::ReadHandler::ApplicationCallback
+{
+public:
+    void OnSubscriptionEstablished(chip::app::ReadHandler &handler) override
+    {
+        if (!g_boot_first_subscription)
+        {
+            g_boot_first_subscription = true;
+            ESP_LOGI(TAG, "Boot: first subscription established at %lld ms", esp_timer_get_time() / 1000);
+        }
+    }
+};
+
+static ShadeReadHandlerCallback g_read_handler_callback;
+
+// Команды из потока CHIP выполняет задача контроллера
+static void matter_post_request(uint8_t shade, controller_request_kind_t kind, uint16_t percent100ths,
+                                uint32_t transition_ms)
+{
+    controller_request_t request = {};
+    request.kind = kind;
+    request.shade = shade;
+    request.percentage = percent100ths / 100.0f;
+    request.limits.transition_ms = transition_ms;
+    if (controller_post_request(&request) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Shade %u: command %d dropped", shade + 1, kind);
+    }
 }
 
 esp_err_t app_attribute_update_cb(attribute::callback_type_t type, uint16_t endpoint_id, uint32_t cluster_id,
                                   uint32_t attribute_id, esp_matter_attr_val_t *val, void *priv_data)
 {
+    if (type != attribute::PRE_UPDATE || cluster_id != WindowCovering::Id || g_updating_attributes)
+    {
+        return ESP_OK;
+    }
+
+    int shade = matter_shade_by_endpoint(endpoint_id);
+    if (shade < 0)
+    {
+        return ESP_OK;
+    }
+
+    // GoToLiftPercentage, UpOrOpen и DownOrClose задают цель подъема.
+    // StopMotion записывает в цель текущую позицию - это остановка
+    if (attribute_id == WindowCovering::Attributes::TargetPositionLiftPercent100ths::Id &&
+        val->type == ESP_MATTER_VAL_TYPE_NULLABLE_UINT16)
+    {
+        if (val->val.u16 > 10000)
+        {
+            return ESP_OK;
+        }
+
+        if (val->val.u16 == g_shades[shade].reported_current && controller_is_moving(shade))
+        {
+            ESP_LOGI(TAG, "Shade %d: stop motion", shade + 1);
+            matter_post_request(shade, CONTROLLER_REQUEST_STOP, 0, 0);
+        }
+        else
+        {
+            ESP_LOGI(TAG, "Shade %d: lift target: %u", shade + 1, val->val.u16);
+            matter_post_request(shade, CONTROLLER_REQUEST_POSITION, val->val.u16, 0);
+        }
+        // Собственная запись цели не нужна: она уже в кластере
+        g_shades[shade].reported_target = val->val.u16;
+    }
+
+#ifdef CONFIG_ZEBRA_BLINDS_SUPPORT
+    // Наклон Matter управляет совмещением полос зебры
+    if (attribute_id == WindowCovering::Attributes::TargetPositionTiltPercent100ths::Id &&
+        val->type == ESP_MATTER_VAL_TYPE_NULLABLE_UINT16)
+    {
+        // null (0xFFFF) и значения больше 100% не являются целью
+        if (val->val.u16 > 10000)
+        {
+            return ESP_OK;
+        }
+
+        ESP_LOGI(TAG, "Shade %d: tilt target: %u", shade + 1, val->val.u16);
+        matter_post_request(shade, CONTROLLER_REQUEST_TILT, val->val.u16, 0);
+    }
+#endif
+
     return ESP_OK;
 }
 
+// Сцены: подъем сохраняется с точностью до 1/100 % и при вызове сцены
+// восстанавливается на месте, с временем перехода из RecallScene. У штор
+// зебра наклон - точное положение внутри периода полос, поэтому сохраненный
+// подъем восстанавливает и совмещение полос
+class ShadeSceneHandler : public chip::scenes::DefaultSceneHandlerImpl
+{
+public:
+    void GetSupportedClusters(chip::EndpointId endpoint, chip::Span<chip::ClusterId> &clusterBuffer) override
+    {
+        if (matter_shade_by_endpoint(endpoint) >= 0 && clusterBuffer.size() >= 1)
+        {
+            clusterBuffer[0] = WindowCovering::Id;
+            clusterBuffer.reduce_size(1);
+        }
+        else
+        {
+            clusterBuffer.reduce_size(0);
+        }
+    }
+
+    bool SupportsCluster(chip::EndpointId endpoint, chip::ClusterId cluster) override
+    {
+        return matter_shade_by_endpoint(endpoint) >= 0 && cluster == WindowCovering::Id;
+    }
+
+    CHIP_ERROR SerializeSave(chip::EndpointId endpoint, chip::ClusterId cluster,
+                             chip::MutableByteSpan &serializedBytes) override
+    {
+        using AttributeValuePair = ScenesManagement::Structs::AttributeValuePairStruct::Type;
+
+        int shade = matter_shade_by_endpoint(endpoint);
+        VerifyOrReturnError(shade >= 0, CHIP_ERROR_INVALID_ARGUMENT);
+
+        AttributeValuePair pairs[1];
+        pairs[0].attributeID = WindowCovering::Attributes::CurrentPositionLiftPercent100ths::Id;
+        pairs[0].valueUnsigned16.SetValue(matter_percent100ths(controller_get_position_percentage(shade)));
+
+        chip::app::DataModel::List<AttributeValuePair> attributeValueList(pairs);
+        return EncodeAttributeValueList(attributeValueList, serializedBytes);
+    }
+
+    CHIP_ERROR ApplyScene(chip::EndpointId endpoint, chip::ClusterId cluster, const chip::ByteSpan &serializedBytes,
+                          chip::scenes::TransitionTimeMs timeMs) override
+    {
+        int shade = matter_shade_by_endpoint(endpoint);
+        VerifyOrReturnError(shade >= 0, CHIP_ERROR_INVALID_ARGUMENT);
+
+        chip::app::DataModel::DecodableList<ScenesManagement::Structs::AttributeValuePairStruct::DecodableType>
+            attributeValueList;
+        ReturnErrorOnFailure(DecodeAttributeValueList(serializedBytes, attributeValueList));
+
+        bool has_lift = false;
+        bool has_tilt = false;
+        uint16_t lift = 0;
+        uint16_t tilt = 0;
+
+        auto pair_iterator = attributeValueList.begin();
+        while (pair_iterator.Next())
+        {
+            auto &pair = pair_iterator.GetValue();
+            if (!pair.valueUnsigned16.HasValue() || pair.valueUnsigned16.Value() > 10000)
+            {
+                continue;
+            }
+
+            if (pair.attributeID == WindowCovering::Attributes::CurrentPositionLiftPercent100ths::Id)
+            {
+                has_lift = true;
+                lift = pair.valueUnsigned16.Value();
+            }
+            else if (pair.attributeID == WindowCovering::Attributes::CurrentPositionTiltPercent100ths::Id)
+            {
+                has_tilt = true;
+                tilt = pair.valueUnsigned16.Value();
+            }
+        }
+        ReturnErrorOnFailure(pair_iterator.GetStatus());
+
+        ESP_LOGI(TAG, "Shade %d: scene recall: lift %u, tilt %u, transition %lu ms", shade + 1, lift, tilt, timeMs);
+
+        // Наклон отдельно применяется только в сцене без подъема: иначе он отменил бы движение
+        if (has_lift)
+        {
+            matter_post_request(shade, CONTROLLER_REQUEST_POSITION, lift, timeMs);
+        }
+        else if (has_tilt)
+        {
+            matter_post_request(shade, CONTROLLER_REQUEST_TILT, tilt, 0);
+        }
+        return CHIP_NO_ERROR;
+    }
+};
+
+static ShadeSceneHandler g_scene_handler;
+
+// Регистрация обработчиков в сервере. Выполняется в потоке CHIP после запуска
+static void matter_register_handlers(intptr_t arg)
+{
+    for (int shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        ScenesManagement::ScenesServer::Instance().RegisterSceneHandler(g_shades[shade].endpoint_id, &g_scene_handler);
+    }
+    chip::app::InteractionModelEngine::GetInstance()->RegisterReadHandlerAppCallback(&g_read_handler_callback);
+}
+
 esp_err_t app_identification_cb(identification::callback_type_t type, uint16_t endpoint_id, uint8_t effect_id,
                                 uint8_t effect_variant, void *priv_data)
 {
@@ -40,12 +498,69 @@ void matter_integration_init(void)
     node::config_t node_config;
     node_t *node = node::create(&node_config, app_attribute_update_cb, app_identification_cb);
 
-    // 2. Создание эндпоинта Window Covering (ID для штор)
-    window_covering_device::config_t window_config;
-    // Тип 0x08 = Rollershade (рулонная штора)
-    // window_config.window_covering.device_type_id = 0x08;
-    endpoint_t *endpoint = window_covering_device::create(node, &window_config, ENDPOINT_FLAG_NONE, NULL);
+    // 2. Создание эндпоинтов Window Covering (ID для штор), по одному на штору платы
+    for (uint8_t shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        window_covering_device::config_t window_config;
+        // Тип 0x08 = Rollershade (рулонная штора)
+        // window_config.window_covering.device_type_id = 0x08;
+        endpoint_t *endpoint = window_covering_device::create(node, &window_config, ENDPOINT_FLAG_NONE, NULL);
+        g_shades[shade].endpoint_id = endpoint::get_id(endpoint);
+        g_shades[shade].reported_current = UINT16_MAX;
+        g_shades[shade].reported_target = UINT16_MAX;
+        g_shades[shade].reported_status = 0;
+
+        // Подъем с позицией: 0 - открыто (верх), 10000 - закрыто
+        cluster_t *lift_cluster = cluster::get(endpoint, WindowCovering::Id);
+        window_covering::feature::lift::config_t lift_config;
+        window_covering::feature::position_aware_lift::config_t lift_position_config;
+        window_covering::feature::lift::add(lift_cluster, &lift_config);
+        window_covering::feature::position_aware_lift::add(lift_cluster, &lift_position_config);
+
+        // Группы: одна групповая (multicast) команда двигает все шторы комнаты без
+        // отдельной CASE сессии с каждой. Сцены сохраняют позицию на самом устройстве
+        if (cluster::get(endpoint, Groups::Id) == NULL)
+        {
+            cluster::groups::config_t groups_config;
+            cluster::groups::create(endpoint, &groups_config, CLUSTER_FLAG_SERVER);
+        }
+        if (cluster::get(endpoint, ScenesManagement::Id) == NULL)
+        {
+            cluster::scenes_management::config_t scenes_config;
+            cluster::scenes_management::create(endpoint, &scenes_config, CLUSTER_FLAG_SERVER);
+        }
+
+#ifdef CONFIG_ZEBRA_BLINDS_SUPPORT
+        // Наклон для штор зебра: 0 - полосы совмещены, 10000 - перекрыты
+        cluster_t *window_cluster = cluster::get(endpoint, WindowCovering::Id);
+        window_covering::feature::tilt::config_t tilt_config;
+        window_covering::feature::position_aware_tilt::config_t tilt_position_config;
+        window_covering::feature::tilt::add(window_cluster, &tilt_config);
+        window_covering::feature::position_aware_tilt::add(window_cluster, &tilt_position_config);
+#endif
+
+        ESP_LOGI(TAG, "Shade %u: endpoint %u", shade + 1, g_shades[shade].endpoint_id);
+    }
+
+    esp_timer_create_args_t report_timer_args = {
+        .callback = &matter_report_timer_cb,
+        .name = "matter_report"};
+    esp_timer_create(&report_timer_args, &g_report_timer);
 
     // 3. Запуск Matter
+    int64_t start_us = esp_timer_get_time();
     esp_matter::start(app_event_cb);
+    ESP_LOGI(TAG, "Boot: esp_matter::start took %lld ms, done at %lld ms",
+             (esp_timer_get_time() - start_us) / 1000, esp_timer_get_time() / 1000);
+    chip::DeviceLayer::PlatformMgr().ScheduleWork(matter_register_handlers, 0);
+
+    // 4. Состояние контроллера в атрибуты кластера
+    controller_add_state_callback(matter_controller_state_cb, NULL);
+    controller_add_position_callback(matter_controller_position_cb, NULL);
+    matter_report_all();
+}
+
+void matter_integration_update_state(uint8_t shade, state_t state, float position)
+{
+    matter_report(shade, state, position, true);
 }
@@ -9,17 +9,11 @@ extern "C"
 {
 #endif
 
-    typedef struct
-    {
-        bool is_open;
-        uint8_t position_percent;
-        bool is_moving;
-    } matter_shade_state_t;
-
     void matter_integration_init(void);
-    void matter_integration_update_state(state_t state, float position);
-    void matter_integration_set_position_callback(void (*callback)(uint8_t position));
-    void matter_integration_set_move_callback(void (*callback)(bool direction));
+    // Немедленный перенос состояния шторы shade в атрибуты WindowCovering ее
+    // эндпоинта (позиция 0% - верх). Обычно не нужен: интеграция подписана на
+    // уведомления контроллера
+    void matter_integration_update_state(uint8_t shade, state_t state, float position);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,389 @@
+#include "motion_planner.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *TAG = "motion_planner";
+
+#define SPEED_ZONES CONFIG_MOTOR_SPEED_ZONES
+#define SPEED_MIN 1
+#define SPEED_MAX 100
+
+// Ограничение ускорения: шагов на единицу изменения скорости
+#define ACCEL_STEPS CONFIG_MOTOR_ACCEL_STEPS
+#define START_SPEED CONFIG_MOTOR_START_SPEED
+#define JOG_RAMP_STEPS (CONFIG_MOTOR_JOG_RAMP_STEPS > ACCEL_STEPS ? CONFIG_MOTOR_JOG_RAMP_STEPS : ACCEL_STEPS)
+
+typedef struct
+{
+    uint8_t shade;
+    // Пространство имен NVS: первая штора хранит таблицу под прежним именем
+    char nvs_namespace[16];
+
+    uint32_t backlash_steps;
+    uint32_t travel_steps;
+
+    // Направление, в котором редуктор нагружен после последнего движения.
+    // MOTOR_DIR_STOP - неизвестно (после включения питания)
+    motor_direction_t loaded_direction;
+
+    // Выученная максимальная надежная скорость: [направление][зона хода]
+    uint8_t speed_table[2][SPEED_ZONES];
+    // Скорость, на которой зона проскальзывала в последний раз, 0 - не было.
+    // Обучение останавливается на шаг ниже, иначе скорость снова поднимается до срыва
+    uint8_t speed_ceiling[2][SPEED_ZONES];
+    bool speed_table_dirty;
+    // Снижение после проскальзывания ждет записи: оно сохраняется при первой остановке
+    bool speed_slip_pending;
+    // Время последней записи таблицы: повышения сохраняются не чаще интервала
+    int64_t speed_table_save_us;
+
+    // Текущее движение для смены скорости на границах зон
+    motor_direction_t active_direction;
+    uint32_t active_zone;
+    bool jogging;
+    // Ограничение скорости текущего движения, 0 - без ограничения
+    uint32_t speed_limit;
+} planner_state_t;
+
+static planner_state_t g_planners[CONFIG_SHADE_COUNT];
+
+static void motion_planner_load_speed_table(planner_state_t *p)
+{
+    memset(p->speed_table, CONFIG_MOTOR_DEFAULT_SPEED, sizeof(p->speed_table));
+    memset(p->speed_ceiling, 0, sizeof(p->speed_ceiling));
+
+#ifdef CONFIG_MOTOR_ADAPTIVE_SPEED
+    nvs_handle_t nvs_handle;
+    if (nvs_open(p->nvs_namespace, NVS_READONLY, &nvs_handle) != ESP_OK)
+    {
+        return;
+    }
+
+    size_t length = sizeof(p->speed_table);
+    esp_err_t err = nvs_get_blob(nvs_handle, "speed_table", p->speed_table, &length);
+    if (err != ESP_OK || length != sizeof(p->speed_table))
+    {
+        // Таблица от другого количества зон или отсутствует
+        memset(p->speed_table, CONFIG_MOTOR_DEFAULT_SPEED, sizeof(p->speed_table));
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Shade %u: speed table loaded from NVS", p->shade + 1);
+
+        length = sizeof(p->speed_ceiling);
+        err = nvs_get_blob(nvs_handle, "speed_ceiling", p->speed_ceiling, &length);
+        if (err != ESP_OK || length != sizeof(p->speed_ceiling))
+        {
+            memset(p->speed_ceiling, 0, sizeof(p->speed_ceiling));
+        }
+    }
+
+    nvs_close(nvs_handle);
+#endif
+}
+
+#ifdef CONFIG_MOTOR_ADAPTIVE_SPEED
+// Запись в NVS останавливает кэш flash, поэтому выполняется только после
+// остановки мотора. Снижение после проскальзывания пишется сразу, повышения -
+// не чаще MOTOR_SPEED_SAVE_INTERVAL_S
+static void motion_planner_save_speed_table(planner_state_t *p)
+{
+    if (!p->speed_table_dirty)
+    {
+        return;
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    if (!p->speed_slip_pending && now_us - p->speed_table_save_us < (int64_t)CONFIG_MOTOR_SPEED_SAVE_INTERVAL_S * 1000000)
+    {
+        return;
+    }
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(p->nvs_namespace, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error opening NVS: %s", esp_err_to_name(err));
+        return;
+    }
+
+    err = nvs_set_blob(nvs_handle, "speed_table", p->speed_table, sizeof(p->speed_table));
+    if (err == ESP_OK)
+    {
+        err = nvs_set_blob(nvs_handle, "speed_ceiling", p->speed_ceiling, sizeof(p->speed_ceiling));
+    }
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(nvs_handle);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error saving speed table: %s", esp_err_to_name(err));
+    }
+    else
+    {
+        p->speed_table_dirty = false;
+        p->speed_slip_pending = false;
+        p->speed_table_save_us = now_us;
+    }
+
+    nvs_close(nvs_handle);
+}
+#endif
+
+static uint32_t motion_planner_zone(const planner_state_t *p, int32_t position_steps)
+{
+    if (p->travel_steps == 0 || position_steps <= 0)
+    {
+        return 0;
+    }
+
+    uint32_t zone = (uint32_t)((uint64_t)position_steps * SPEED_ZONES / p->travel_steps);
+    return zone < SPEED_ZONES ? zone : SPEED_ZONES - 1;
+}
+
+void motion_planner_init(void)
+{
+    for (uint8_t shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        planner_state_t *p = &g_planners[shade];
+        memset(p, 0, sizeof(*p));
+        p->shade = shade;
+        if (shade == 0)
+        {
+            strlcpy(p->nvs_namespace, "motion_planner", sizeof(p->nvs_namespace));
+        }
+        else
+        {
+            snprintf(p->nvs_namespace, sizeof(p->nvs_namespace), "shade%u_planner", shade + 1);
+        }
+        p->loaded_direction = MOTOR_DIR_STOP;
+        p->active_direction = MOTOR_DIR_STOP;
+        motion_planner_load_speed_table(p);
+    }
+    ESP_LOGI(TAG, "Motion planner initialized");
+}
+
+// Скорость зоны с учетом ограничения текущего движения
+static uint32_t motion_planner_zone_speed(const planner_state_t *p, motor_direction_t direction, uint32_t zone)
+{
+    uint32_t speed = p->speed_table[direction][zone];
+    return p->speed_limit != 0 && speed > p->speed_limit ? p->speed_limit : speed;
+}
+
+// Запуск движения: старт на скорости трогания и разгон до выученной скорости зоны
+static void motion_planner_start(planner_state_t *p, motor_direction_t direction, uint32_t steps, uint32_t ramp_steps)
+{
+    // При реверсе сначала выбираем люфт, чтобы движение закончилось за один проход
+    uint32_t takeup_steps = 0;
+    if (p->loaded_direction != MOTOR_DIR_STOP && p->loaded_direction != direction)
+    {
+        takeup_steps = p->backlash_steps;
+    }
+
+    int32_t position_steps = motor_get_position_steps(p->shade);
+    uint32_t speed = motion_planner_zone_speed(p, direction, motion_planner_zone(p, position_steps));
+
+    uint32_t start_speed = speed < START_SPEED ? speed : START_SPEED;
+
+    ESP_LOGD(TAG, "Shade %u: planned move: direction %d, %lu steps, backlash %lu, speed %lu",
+             p->shade + 1, direction, steps, takeup_steps, speed);
+
+    p->active_direction = direction;
+    p->active_zone = motion_planner_zone(p, position_steps);
+
+    motor_set_direction(p->shade, direction);
+    motor_set_speed(p->shade, start_speed);
+    motor_step_compensated(p->shade, steps, takeup_steps);
+    motor_ramp_to_speed(p->shade, speed, ramp_steps);
+
+    p->loaded_direction = direction;
+}
+
+void motion_planner_move(uint8_t shade, motor_direction_t direction, uint32_t steps)
+{
+    motion_planner_move_limited(shade, direction, steps, 0);
+}
+
+void motion_planner_move_limited(uint8_t shade, motor_direction_t direction, uint32_t steps, uint32_t max_speed)
+{
+    if (direction == MOTOR_DIR_STOP || steps == 0)
+    {
+        motor_stop(shade);
+        return;
+    }
+
+    planner_state_t *p = &g_planners[shade];
+    p->jogging = false;
+    p->speed_limit = max_speed;
+    motion_planner_start(p, direction, steps, ACCEL_STEPS);
+}
+
+void motion_planner_jog(uint8_t shade, motor_direction_t direction)
+{
+    if (direction == MOTOR_DIR_STOP)
+    {
+        motor_stop(shade);
+        return;
+    }
+
+    // Медленный разгон: короткое удержание дает точную подстройку,
+    // длинное - быстрый проход по всему ходу
+    planner_state_t *p = &g_planners[shade];
+    p->jogging = true;
+    p->speed_limit = 0;
+    motion_planner_start(p, direction, UINT32_MAX, JOG_RAMP_STEPS);
+}
+
+void motion_planner_stop(uint8_t shade)
+{
+    planner_state_t *p = &g_planners[shade];
+    p->jogging = false;
+    // Замедление не прерывается сменой скорости на границе зоны
+    p->active_direction = MOTOR_DIR_STOP;
+
+    if (!motor_is_moving(shade))
+    {
+        return;
+    }
+
+    uint32_t speed = motor_get_speed(shade);
+    if (speed <= START_SPEED)
+    {
+        motor_stop(shade);
+        return;
+    }
+
+    // Замедление до скорости трогания с тем же ограничением ускорения
+    motor_ramp_to_speed(shade, START_SPEED, ACCEL_STEPS);
+    motor_limit_remaining_steps(shade, (speed - START_SPEED) * ACCEL_STEPS);
+}
+
+void motion_planner_update(uint8_t shade, int32_t position_steps)
+{
+    planner_state_t *p = &g_planners[shade];
+    if (p->active_direction == MOTOR_DIR_STOP || !motor_is_moving(shade))
+    {
+        return;
+    }
+
+    // Смена скорости при переходе в другую зону хода
+    uint32_t zone = motion_planner_zone(p, position_steps);
+    if (zone != p->active_zone)
+    {
+        p->active_zone = zone;
+        motor_ramp_to_speed(shade, motion_planner_zone_speed(p, p->active_direction, zone),
+                            p->jogging ? JOG_RAMP_STEPS : ACCEL_STEPS);
+    }
+}
+
+uint32_t motion_planner_get_speed(uint8_t shade, motor_direction_t direction, int32_t position_steps)
+{
+    if (direction == MOTOR_DIR_STOP)
+    {
+        return CONFIG_MOTOR_DEFAULT_SPEED;
+    }
+
+    const planner_state_t *p = &g_planners[shade];
+    return p->speed_table[direction][motion_planner_zone(p, position_steps)];
+}
+
+void motion_planner_set_travel_steps(uint8_t shade, uint32_t travel_steps)
+{
+    g_planners[shade].travel_steps = travel_steps;
+}
+
+void motion_planner_report_slip(uint8_t shade, motor_direction_t direction, int32_t position_steps)
+{
+#ifdef CONFIG_MOTOR_ADAPTIVE_SPEED
+    if (direction == MOTOR_DIR_STOP)
+    {
+        return;
+    }
+
+    planner_state_t *p = &g_planners[shade];
+    uint32_t zone = motion_planner_zone(p, position_steps);
+    uint8_t speed = p->speed_table[direction][zone];
+    uint8_t reduced = (uint8_t)(speed * (100 - CONFIG_MOTOR_SPEED_BACKOFF_PERCENT) / 100);
+    if (reduced < SPEED_MIN)
+        reduced = SPEED_MIN;
+
+    if (reduced != speed || p->speed_ceiling[direction][zone] != speed)
+    {
+        ESP_LOGW(TAG, "Shade %u: slip in zone %lu (%s): speed %u -> %u", shade + 1, zone,
+                 direction == MOTOR_DIR_UP ? "up" : "down", speed, reduced);
+        p->speed_table[direction][zone] = reduced;
+        p->speed_ceiling[direction][zone] = speed;
+        p->speed_table_dirty = true;
+        // Мотор еще шагает: запись - после остановки, без ожидания интервала
+        p->speed_slip_pending = true;
+    }
+
+    // Сразу применяем пониженную скорость к текущему движению
+    if (p->active_direction == direction && p->active_zone == zone && motor_is_moving(shade))
+    {
+        motor_set_speed(shade, motion_planner_zone_speed(p, direction, zone));
+    }
+#endif
+}
+
+void motion_planner_report_clean_travel(uint8_t shade, motor_direction_t direction, int32_t from_steps, int32_t to_steps)
+{
+#ifdef CONFIG_MOTOR_ADAPTIVE_SPEED
+    if (direction == MOTOR_DIR_STOP)
+    {
+        return;
+    }
+
+    planner_state_t *p = &g_planners[shade];
+    uint32_t first = motion_planner_zone(p, from_steps < to_steps ? from_steps : to_steps);
+    uint32_t last = motion_planner_zone(p, from_steps < to_steps ? to_steps : from_steps);
+
+    // Зоны, пройденные без проскальзывания, пробуем на большей скорости,
+    // но не выше шага под скоростью последнего проскальзывания
+    for (uint32_t zone = first; zone <= last; zone++)
+    {
+        uint32_t limit = CONFIG_MOTOR_MAX_SPEED;
+        uint8_t ceiling = p->speed_ceiling[direction][zone];
+        if (ceiling != 0)
+        {
+            limit = ceiling > CONFIG_MOTOR_SPEED_LEARN_STEP ? ceiling - CONFIG_MOTOR_SPEED_LEARN_STEP : SPEED_MIN;
+        }
+
+        uint8_t speed = p->speed_table[direction][zone];
+        if (speed < limit)
+        {
+            uint32_t raised = speed + CONFIG_MOTOR_SPEED_LEARN_STEP;
+            p->speed_table[direction][zone] = raised > limit ? limit : raised;
+            p->speed_table_dirty = true;
+        }
+    }
+#endif
+}
+
+void motion_planner_finish(uint8_t shade)
+{
+#ifdef CONFIG_MOTOR_ADAPTIVE_SPEED
+    motion_planner_save_speed_table(&g_planners[shade]);
+#endif
+}
+
+void motion_planner_set_backlash_steps(uint8_t shade, uint32_t steps)
+{
+    g_planners[shade].backlash_steps = steps;
+    ESP_LOGI(TAG, "Shade %u: backlash compensation: %lu steps", shade + 1, steps);
+}
+
+uint32_t motion_planner_get_backlash_steps(uint8_t shade)
+{
+    return g_planners[shade].backlash_steps;
+}
+
+void motion_planner_reset_direction(uint8_t shade)
+{
+    g_planners[shade].loaded_direction = MOTOR_DIR_STOP;
+}
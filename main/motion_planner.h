@@ -0,0 +1,46 @@
+// components/motion_planner/motion_planner.h
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "motor_control.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Планировщики всех штор платы, shade - номер шторы с нуля
+    void motion_planner_init(void);
+
+    // Запуск движения с учетом люфта редуктора. steps = UINT32_MAX - непрерывное движение
+    void motion_planner_move(uint8_t shade, motor_direction_t direction, uint32_t steps);
+    // То же с ограничением скорости на все движение (0 - выученная скорость зон)
+    void motion_planner_move_limited(uint8_t shade, motor_direction_t direction, uint32_t steps, uint32_t max_speed);
+
+    // Ручное движение: старт на малой скорости и разгон, пока движение продолжается
+    void motion_planner_jog(uint8_t shade, motor_direction_t direction);
+    // Остановка с коротким замедлением в пределах ограничения ускорения
+    void motion_planner_stop(uint8_t shade);
+
+    // Люфт редуктора в шагах, выбираемый при смене направления
+    void motion_planner_set_backlash_steps(uint8_t shade, uint32_t steps);
+    uint32_t motion_planner_get_backlash_steps(uint8_t shade);
+
+    // Забыть направление нагрузки редуктора (например, после ручного вмешательства)
+    void motion_planner_reset_direction(uint8_t shade);
+
+    // Адаптивная скорость: выученная максимальная скорость по направлению и зоне хода
+    void motion_planner_set_travel_steps(uint8_t shade, uint32_t travel_steps);
+    uint32_t motion_planner_get_speed(uint8_t shade, motor_direction_t direction, int32_t position_steps);
+    // Вызывается на каждом сегменте движения для смены скорости между зонами
+    void motion_planner_update(uint8_t shade, int32_t position_steps);
+    // Проскальзывание снижает скорость зоны, чистый проход повышает скорость пройденных зон
+    void motion_planner_report_slip(uint8_t shade, motor_direction_t direction, int32_t position_steps);
+    void motion_planner_report_clean_travel(uint8_t shade, motor_direction_t direction, int32_t from_steps, int32_t to_steps);
+    // Вызывается после остановки мотора: сохранение выученных скоростей в NVS
+    void motion_planner_finish(uint8_t shade);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,20 +4,39 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_timer.h"
+#include "esp_rom_sys.h"
+#ifdef CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
 #include <string.h>
 
 static const char *TAG = "motor_control";
 
-// Конфигурация GPIO пинов для ULN2003 из Kconfig
-#define MOTOR_PIN_1 CONFIG_MOTOR_PIN_1
-#define MOTOR_PIN_2 CONFIG_MOTOR_PIN_2
-#define MOTOR_PIN_3 CONFIG_MOTOR_PIN_3
-#define MOTOR_PIN_4 CONFIG_MOTOR_PIN_4
-#define MOTOR_ENABLE_PIN CONFIG_MOTOR_ENABLE_PIN
-
 // Параметры шагового двигателя из Kconfig
 #define STEPS_PER_REVOLUTION CONFIG_MOTOR_STEPS_PER_REVOLUTION
-#define MICROSECONDS_PER_STEP_MIN 800 // Минимальная задержка между шагами
+#define MICROSECONDS_PER_STEP_MIN 800  // Минимальная задержка между шагами
+#define MICROSECONDS_PER_STEP_MAX 5000 // Задержка между шагами на самой медленной скорости
+#define SEGMENT_STEPS CONFIG_MOTOR_SEGMENT_STEPS
+
+// Пины ULN2003 одного мотора
+typedef struct
+{
+    int in[4];
+    int enable; // -1 - не используется
+} motor_pins_t;
+
+// Конфигурация GPIO пинов из Kconfig: первая штора - меню мотора, остальные - меню штор
+static const motor_pins_t MOTOR_PINS[CONFIG_SHADE_COUNT] = {
+    {{CONFIG_MOTOR_PIN_1, CONFIG_MOTOR_PIN_2, CONFIG_MOTOR_PIN_3, CONFIG_MOTOR_PIN_4}, CONFIG_MOTOR_ENABLE_PIN},
+#if CONFIG_SHADE_COUNT >= 2
+    {{CONFIG_SHADE2_MOTOR_PIN_1, CONFIG_SHADE2_MOTOR_PIN_2, CONFIG_SHADE2_MOTOR_PIN_3, CONFIG_SHADE2_MOTOR_PIN_4},
+     CONFIG_SHADE2_MOTOR_ENABLE_PIN},
+#endif
+#if CONFIG_SHADE_COUNT >= 3
+    {{CONFIG_SHADE3_MOTOR_PIN_1, CONFIG_SHADE3_MOTOR_PIN_2, CONFIG_SHADE3_MOTOR_PIN_3, CONFIG_SHADE3_MOTOR_PIN_4},
+     CONFIG_SHADE3_MOTOR_ENABLE_PIN},
+#endif
+};
 
 // Последовательности шагов для полношагового режима
 static const uint8_t step_sequence_full[][4] = {
@@ -40,71 +59,99 @@ static const uint8_t step_sequence_half[][4] = {
 // Структура состояния двигателя
 typedef struct
 {
+    uint8_t shade;
+    const motor_pins_t *pins;
     bool is_moving;
     motor_direction_t current_direction;
     uint32_t current_speed;
+    uint32_t ramp_target_speed;
+    uint32_t ramp_steps_per_unit; // 0 - изменение скорости не выполняется
+    uint32_t ramp_counter;
     uint32_t remaining_steps;
+    uint32_t takeup_steps;
     uint32_t current_step;
+    int32_t position_steps;
+    uint32_t segment_counter;
+    int64_t start_time_us;
     bool use_half_step;
     bool enable_pin_active;
     esp_timer_handle_t step_timer;
-    TaskHandle_t motor_task_handle;
+    bool pm_locked; // Блокировки питания удерживаются на время движения
 } motor_state_t;
 
-static motor_state_t motor_state = {0};
+static motor_state_t g_motors[CONFIG_SHADE_COUNT];
+static motor_event_callback_t g_event_callback = NULL;
+
+#ifdef CONFIG_PM_ENABLE
+// На ходу шаги идут по esp_timer с интервалом около миллисекунды: легкий сон
+// и снижение частоты APB сбили бы темп шагов. Блокировки общие: каждый
+// движущийся мотор захватывает их один раз
+static esp_pm_lock_handle_t g_pm_no_sleep_lock = NULL;
+static esp_pm_lock_handle_t g_pm_apb_lock = NULL;
+#endif
 
 // Прототипы внутренних функций
-static void motor_set_gpio_mode(void);
-static void motor_write_step(uint8_t step_index);
+static void motor_set_gpio_mode(const motor_pins_t *pins);
+static void motor_write_step(motor_state_t *m, uint8_t step_index);
 static void motor_step_callback(void *arg);
-static void motor_control_task(void *parameter);
 static uint32_t calculate_delay_from_speed(uint32_t speed);
-static void motor_enable(bool enable);
+static void motor_enable(motor_state_t *m, bool enable);
+static void motor_apply_speed(motor_state_t *m, uint32_t speed);
+static void motor_ramp_advance(motor_state_t *m);
+static void motor_stop_state(motor_state_t *m);
 
 void motor_control_init(void)
 {
-    ESP_LOGI(TAG, "Initializing motor control for ULN2003");
+    ESP_LOGI(TAG, "Initializing motor control for ULN2003, %d motor(s)", CONFIG_SHADE_COUNT);
 
-    // Инициализация состояния
-    memset(&motor_state, 0, sizeof(motor_state));
-    motor_state.current_direction = MOTOR_DIR_STOP;
-    motor_state.current_speed = CONFIG_MOTOR_DEFAULT_SPEED;
-    motor_state.use_half_step = CONFIG_MOTOR_USE_HALF_STEP;
-
-    // Настройка GPIO
-    motor_set_gpio_mode();
-
-    // Создание таймера для шагов
-    esp_timer_create_args_t timer_args = {
-        .callback = &motor_step_callback,
-        .name = "motor_step_timer"};
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "motor", &g_pm_no_sleep_lock);
+    esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "motor", &g_pm_apb_lock);
+#endif
 
-    esp_err_t ret = esp_timer_create(&timer_args, &motor_state.step_timer);
-    if (ret != ESP_OK)
+    for (uint8_t shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
     {
-        ESP_LOGE(TAG, "Failed to create step timer: %s", esp_err_to_name(ret));
-        return;
-    }
-
-    // Установка всех пинов в LOW
-    motor_write_step(0);
-
-    // Включение двигателя
-    motor_enable(true);
+        motor_state_t *m = &g_motors[shade];
+
+        // Инициализация состояния
+        memset(m, 0, sizeof(*m));
+        m->shade = shade;
+        m->pins = &MOTOR_PINS[shade];
+        m->current_direction = MOTOR_DIR_STOP;
+        m->current_speed = CONFIG_MOTOR_DEFAULT_SPEED;
+        m->use_half_step = CONFIG_MOTOR_USE_HALF_STEP;
+
+        // Настройка GPIO
+        motor_set_gpio_mode(m->pins);
+
+        // Создание таймера для шагов
+        esp_timer_create_args_t timer_args = {
+            .callback = &motor_step_callback,
+            .arg = m,
+            .name = "motor_step_timer"};
+
+        esp_err_t ret = esp_timer_create(&timer_args, &m->step_timer);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create step timer for motor %u: %s", shade + 1, esp_err_to_name(ret));
+            continue;
+        }
 
-    // Создание задачи управления
-    xTaskCreate(motor_control_task, "motor_control", 2048, NULL, 5, &motor_state.task_handle);
+        // Установка всех пинов в LOW. Драйвер включается при первом движении:
+        // в покое он не нужен, а ожидание стабилизации задерживало бы загрузку
+        motor_write_step(m, 0);
 
-    ESP_LOGI(TAG, "Motor control initialized. Pins: IN1=%d, IN2=%d, IN3=%d, IN4=%d, EN=%d",
-             MOTOR_PIN_1, MOTOR_PIN_2, MOTOR_PIN_3, MOTOR_PIN_4, MOTOR_ENABLE_PIN);
+        ESP_LOGI(TAG, "Motor %u initialized. Pins: IN1=%d, IN2=%d, IN3=%d, IN4=%d, EN=%d", shade + 1,
+                 m->pins->in[0], m->pins->in[1], m->pins->in[2], m->pins->in[3], m->pins->enable);
+    }
 }
 
-static void motor_set_gpio_mode(void)
+static void motor_set_gpio_mode(const motor_pins_t *pins)
 {
     // Настройка пинов управления катушками
     gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << MOTOR_PIN_1) | (1ULL << MOTOR_PIN_2) |
-                        (1ULL << MOTOR_PIN_3) | (1ULL << MOTOR_PIN_4),
+        .pin_bit_mask = (1ULL << pins->in[0]) | (1ULL << pins->in[1]) |
+                        (1ULL << pins->in[2]) | (1ULL << pins->in[3]),
         .mode = GPIO_MODE_OUTPUT,
         .pull_up_en = GPIO_PULLUP_DISABLE,
         .pull_down_en = GPIO_PULLDOWN_DISABLE,
@@ -112,10 +159,10 @@ static void motor_set_gpio_mode(void)
     gpio_config(&io_conf);
 
     // Настройка пина управления питанием (если используется)
-    if (MOTOR_ENABLE_PIN >= 0)
+    if (pins->enable >= 0)
     {
         gpio_config_t enable_conf = {
-            .pin_bit_mask = (1ULL << MOTOR_ENABLE_PIN),
+            .pin_bit_mask = (1ULL << pins->enable),
             .mode = GPIO_MODE_OUTPUT,
             .pull_up_en = GPIO_PULLUP_DISABLE,
             .pull_down_en = GPIO_PULLDOWN_DISABLE,
@@ -124,24 +171,55 @@ static void motor_set_gpio_mode(void)
     }
 }
 
-static void motor_enable(bool enable)
+// Блокировки питания: в покое чип свободно уходит в легкий сон
+static void motor_pm_hold(motor_state_t *m, bool hold)
+{
+    if (hold == m->pm_locked)
+    {
+        return;
+    }
+    m->pm_locked = hold;
+
+#ifdef CONFIG_PM_ENABLE
+    if (hold)
+    {
+        esp_pm_lock_acquire(g_pm_no_sleep_lock);
+        esp_pm_lock_acquire(g_pm_apb_lock);
+    }
+    else
+    {
+        esp_pm_lock_release(g_pm_apb_lock);
+        esp_pm_lock_release(g_pm_no_sleep_lock);
+    }
+#endif
+}
+
+// Время включения драйвера до первого шага
+#define MOTOR_ENABLE_SETTLE_US 50
+
+// Вызывается и из задачи esp_timer (остановка по последнему шагу), поэтому
+// без vTaskDelay: сон задержал бы все таймеры, в том числе кнопки и отчеты
+static void motor_enable(motor_state_t *m, bool enable)
 {
-    if (MOTOR_ENABLE_PIN >= 0)
+    if (m->pins->enable >= 0)
     {
-        gpio_set_level(MOTOR_ENABLE_PIN, enable ? 1 : 0);
-        motor_state.enable_pin_active = enable;
+        gpio_set_level((gpio_num_t)m->pins->enable, enable ? 1 : 0);
+        m->enable_pin_active = enable;
 
-        // Небольшая задержка для стабилизации
-        vTaskDelay(pdMS_TO_TICKS(1));
+        // Выключение ждать не нужно, включение - короткая пауза перед шагом
+        if (enable)
+        {
+            esp_rom_delay_us(MOTOR_ENABLE_SETTLE_US);
+        }
     }
 }
 
-static void motor_write_step(uint8_t step_index)
+static void motor_write_step(motor_state_t *m, uint8_t step_index)
 {
     const uint8_t *sequence;
     uint8_t sequence_size;
 
-    if (motor_state.use_half_step)
+    if (m->use_half_step)
     {
         sequence = step_sequence_half[0];
         sequence_size = 8;
@@ -159,7 +237,7 @@ static void motor_write_step(uint8_t step_index)
 
     // Копируем нужный шаг из последовательности
     uint8_t step[4];
-    if (motor_state.use_half_step)
+    if (m->use_half_step)
     {
         memcpy(step, step_sequence_half[step_index], 4);
     }
@@ -169,10 +247,10 @@ static void motor_write_step(uint8_t step_index)
     }
 
     // Устанавливаем уровни на пины
-    gpio_set_level(MOTOR_PIN_1, step[0]);
-    gpio_set_level(MOTOR_PIN_2, step[1]);
-    gpio_set_level(MOTOR_PIN_3, step[2]);
-    gpio_set_level(MOTOR_PIN_4, step[3]);
+    for (int i = 0; i < 4; i++)
+    {
+        gpio_set_level((gpio_num_t)m->pins->in[i], step[i]);
+    }
 }
 
 static uint32_t calculate_delay_from_speed(uint32_t speed)
@@ -185,7 +263,7 @@ static uint32_t calculate_delay_from_speed(uint32_t speed)
 
     // Конвертируем скорость в задержку
     // Чем выше скорость, тем меньше задержка
-    uint32_t max_delay = 5000;                      // 5ms для самой медленной скорости
+    uint32_t max_delay = MICROSECONDS_PER_STEP_MAX; // 5ms для самой медленной скорости
     uint32_t min_delay = MICROSECONDS_PER_STEP_MIN; // 0.8ms для самой быстрой скорости
 
     uint32_t delay = max_delay - (speed * (max_delay - min_delay) / 100);
@@ -195,189 +273,345 @@ static uint32_t calculate_delay_from_speed(uint32_t speed)
 
 static void motor_step_callback(void *arg)
 {
-    if (!motor_state.is_moving || motor_state.remaining_steps == 0)
+    motor_state_t *m = (motor_state_t *)arg;
+
+    if (!m->is_moving || m->remaining_steps == 0)
     {
         return;
     }
 
     // Вычисляем следующий шаг
-    uint8_t sequence_size = motor_state.use_half_step ? 8 : 4;
+    uint8_t sequence_size = m->use_half_step ? 8 : 4;
+
+    int32_t position_delta = 0;
 
-    if (motor_state.current_direction == MOTOR_DIR_UP)
+    if (m->current_direction == MOTOR_DIR_UP)
     {
-        motor_state.current_step = (motor_state.current_step + 1) % sequence_size;
+        m->current_step = (m->current_step + 1) % sequence_size;
+        position_delta = -1;
     }
-    else if (motor_state.current_direction == MOTOR_DIR_DOWN)
+    else if (m->current_direction == MOTOR_DIR_DOWN)
     {
-        motor_state.current_step = (motor_state.current_step == 0) ? (sequence_size - 1) : (motor_state.current_step - 1);
+        m->current_step = (m->current_step == 0) ? (sequence_size - 1) : (m->current_step - 1);
+        position_delta = 1;
+    }
+
+    // Шаги выбора люфта не перемещают штору
+    if (m->takeup_steps > 0)
+    {
+        m->takeup_steps--;
+    }
+    else
+    {
+        m->position_steps += position_delta;
     }
 
     // Выводим шаг на пины
-    motor_write_step(motor_state.current_step);
+    motor_write_step(m, m->current_step);
 
     // Уменьшаем количество оставшихся шагов
-    motor_state.remaining_steps--;
+    m->remaining_steps--;
+
+    // Изменение скорости с ограничением ускорения
+    if (m->ramp_steps_per_unit > 0 && m->remaining_steps > 0 &&
+        ++m->ramp_counter >= m->ramp_steps_per_unit)
+    {
+        m->ramp_counter = 0;
+        motor_ramp_advance(m);
+    }
+
+    // Сообщаем подписчику о завершении сегмента
+    if (++m->segment_counter >= SEGMENT_STEPS)
+    {
+        m->segment_counter = 0;
+        if (g_event_callback != NULL)
+        {
+            g_event_callback(m->shade, MOTOR_EVENT_SEGMENT, m->position_steps);
+        }
+    }
 
     // Если шаги закончились, останавливаем двигатель
-    if (motor_state.remaining_steps == 0)
+    if (m->remaining_steps == 0)
     {
-        motor_stop();
+        motor_stop_state(m);
     }
 }
 
-void motor_set_direction(motor_direction_t direction)
+void motor_set_direction(uint8_t shade, motor_direction_t direction)
 {
-    if (direction == motor_state.current_direction)
+    motor_state_t *m = &g_motors[shade];
+
+    if (direction == m->current_direction)
     {
         return;
     }
 
-    ESP_LOGI(TAG, "Setting motor direction: %d", direction);
+    ESP_LOGI(TAG, "Motor %u: setting direction %d", shade + 1, direction);
 
-    motor_state.current_direction = direction;
+    m->current_direction = direction;
 
     // Если двигатель движется, перезапускаем с новым направлением
-    if (motor_state.is_moving && motor_state.remaining_steps > 0)
+    if (m->is_moving && m->remaining_steps > 0)
     {
         // Останавливаем текущий таймер
-        esp_timer_stop(motor_state.step_timer);
+        esp_timer_stop(m->step_timer);
 
         // Перезапускаем с новым направлением
-        uint32_t delay = calculate_delay_from_speed(motor_state.current_speed);
-        esp_timer_start_periodic(motor_state.step_timer, delay);
+        uint32_t delay = calculate_delay_from_speed(m->current_speed);
+        esp_timer_start_periodic(m->step_timer, delay);
+    }
+}
+
+static void motor_apply_speed(motor_state_t *m, uint32_t speed)
+{
+    m->current_speed = speed;
+
+    // Если двигатель движется, обновляем задержку таймера
+    if (m->is_moving && m->remaining_steps > 0)
+    {
+        uint32_t delay = calculate_delay_from_speed(speed);
+
+        // Перезапускаем таймер с новой задержкой
+        esp_timer_stop(m->step_timer);
+        esp_timer_start_periodic(m->step_timer, delay);
     }
 }
 
-void motor_set_speed(uint32_t speed)
+// Изменение скорости на одну единицу в сторону целевой. Выполняется в контексте таймера шагов
+static void motor_ramp_advance(motor_state_t *m)
 {
-    if (speed == motor_state.current_speed)
+    uint32_t speed = m->current_speed;
+
+    if (speed < m->ramp_target_speed)
+    {
+        speed++;
+    }
+    else if (speed > m->ramp_target_speed)
+    {
+        speed--;
+    }
+
+    if (speed == m->ramp_target_speed)
+    {
+        m->ramp_steps_per_unit = 0;
+    }
+
+    motor_apply_speed(m, speed);
+}
+
+void motor_set_speed(uint8_t shade, uint32_t speed)
+{
+    motor_state_t *m = &g_motors[shade];
+
+    // Явная установка скорости отменяет плавное изменение
+    m->ramp_steps_per_unit = 0;
+
+    if (speed == m->current_speed)
     {
         return;
     }
 
-    ESP_LOGI(TAG, "Setting motor speed: %lu", speed);
+    ESP_LOGI(TAG, "Motor %u: setting speed %lu", shade + 1, speed);
 
-    motor_state.current_speed = speed;
+    motor_apply_speed(m, speed);
+}
 
-    // Если двигатель движется, обновляем задержку таймера
-    if (motor_state.is_moving && motor_state.remaining_steps > 0)
+uint32_t motor_get_speed(uint8_t shade)
+{
+    return g_motors[shade].current_speed;
+}
+
+uint32_t motor_speed_for_step_interval(uint32_t interval_us)
+{
+    if (interval_us >= MICROSECONDS_PER_STEP_MAX)
+        return 1;
+    if (interval_us <= MICROSECONDS_PER_STEP_MIN)
+        return 100;
+
+    // Обратно к calculate_delay_from_speed; округление вниз дает интервал не короче заданного
+    uint32_t speed = (MICROSECONDS_PER_STEP_MAX - interval_us) * 100 /
+                     (MICROSECONDS_PER_STEP_MAX - MICROSECONDS_PER_STEP_MIN);
+    return speed > 0 ? speed : 1;
+}
+
+void motor_ramp_to_speed(uint8_t shade, uint32_t speed, uint32_t steps_per_unit)
+{
+    motor_state_t *m = &g_motors[shade];
+
+    if (steps_per_unit == 0 || !m->is_moving)
     {
-        uint32_t delay = calculate_delay_from_speed(speed);
+        motor_set_speed(shade, speed);
+        return;
+    }
 
-        // Перезапускаем таймер с новой задержкой
-        esp_timer_stop(motor_state.step_timer);
-        esp_timer_start_periodic(motor_state.step_timer, delay);
+    ESP_LOGD(TAG, "Motor %u: ramping speed %lu -> %lu, %lu steps per unit",
+             shade + 1, m->current_speed, speed, steps_per_unit);
+
+    m->ramp_target_speed = speed;
+    m->ramp_counter = 0;
+    m->ramp_steps_per_unit = speed != m->current_speed ? steps_per_unit : 0;
+}
+
+void motor_limit_remaining_steps(uint8_t shade, uint32_t steps)
+{
+    motor_state_t *m = &g_motors[shade];
+
+    if (!m->is_moving)
+    {
+        return;
+    }
+
+    if (steps == 0)
+    {
+        motor_stop_state(m);
+        return;
+    }
+
+    // Шаги выбора люфта проходятся полностью
+    uint32_t limit = m->takeup_steps + steps;
+    if (m->remaining_steps > limit)
+    {
+        m->remaining_steps = limit;
     }
 }
 
-void motor_step(uint32_t steps)
+void motor_step(uint8_t shade, uint32_t steps)
+{
+    motor_step_compensated(shade, steps, 0);
+}
+
+void motor_step_compensated(uint8_t shade, uint32_t steps, uint32_t takeup_steps)
 {
+    motor_state_t *m = &g_motors[shade];
+
     if (steps == 0)
     {
-        motor_stop();
+        motor_stop_state(m);
         return;
     }
 
-    ESP_LOGI(TAG, "Starting motor for %lu steps", steps);
+    ESP_LOGI(TAG, "Motor %u: starting for %lu steps (+%lu backlash)", shade + 1, steps, takeup_steps);
 
     // Останавливаем текущее движение
-    esp_timer_stop(motor_state.step_timer);
+    esp_timer_stop(m->step_timer);
 
     // Устанавливаем параметры движения
-    motor_state.remaining_steps = steps;
-    motor_state.is_moving = true;
+    m->remaining_steps = (steps > UINT32_MAX - takeup_steps) ? UINT32_MAX : steps + takeup_steps;
+    m->takeup_steps = takeup_steps;
+    m->segment_counter = 0;
+    m->ramp_steps_per_unit = 0;
+    m->start_time_us = esp_timer_get_time();
+    m->is_moving = true;
+    motor_pm_hold(m, true);
 
     // Включаем двигатель
-    motor_enable(true);
+    motor_enable(m, true);
 
     // Запускаем таймер
-    uint32_t delay = calculate_delay_from_speed(motor_state.current_speed);
-    esp_err_t ret = esp_timer_start_periodic(motor_state.step_timer, delay);
+    uint32_t delay = calculate_delay_from_speed(m->current_speed);
+    esp_err_t ret = esp_timer_start_periodic(m->step_timer, delay);
 
     if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to start step timer: %s", esp_err_to_name(ret));
-        motor_state.is_moving = false;
+        ESP_LOGE(TAG, "Motor %u: failed to start step timer: %s", shade + 1, esp_err_to_name(ret));
+        m->is_moving = false;
+        motor_pm_hold(m, false);
         return;
     }
 }
 
-bool motor_is_moving(void)
+bool motor_is_moving(uint8_t shade)
 {
-    return motor_state.is_moving;
+    return g_motors[shade].is_moving;
 }
 
-void motor_stop(void)
+static void motor_stop_state(motor_state_t *m)
 {
-    if (!motor_state.is_moving)
+    if (!m->is_moving)
     {
         return;
     }
 
-    ESP_LOGI(TAG, "Stopping motor");
+    ESP_LOGI(TAG, "Motor %u: stopping", m->shade + 1);
 
     // Останавливаем таймер
-    esp_timer_stop(motor_state.step_timer);
+    esp_timer_stop(m->step_timer);
 
     // Сбрасываем состояние
-    motor_state.is_moving = false;
-    motor_state.remaining_steps = 0;
-    motor_state.current_direction = MOTOR_DIR_STOP;
+    m->is_moving = false;
+    m->remaining_steps = 0;
+    m->takeup_steps = 0;
+    m->ramp_steps_per_unit = 0;
+    m->current_direction = MOTOR_DIR_STOP;
 
     // Устанавливаем все пины в LOW для экономии энергии
-    motor_write_step(0);
+    motor_write_step(m, 0);
+    motor_pm_hold(m, false);
 
 // Выключаем питание двигателя (если есть пин включения)
 #ifdef CONFIG_MOTOR_DISABLE_ON_STOP
-    motor_enable(false);
+    motor_enable(m, false);
 #endif
+
+    if (g_event_callback != NULL)
+    {
+        g_event_callback(m->shade, MOTOR_EVENT_STOPPED, m->position_steps);
+    }
 }
 
-static void motor_control_task(void *parameter)
+void motor_stop(uint8_t shade)
 {
-    ESP_LOGI(TAG, "Motor control task started");
+    motor_stop_state(&g_motors[shade]);
+}
 
-    while (1)
-    {
-        // Задача для мониторинга состояния и обработки крайних случаев
-        vTaskDelay(pdMS_TO_TICKS(100));
+// Дополнительные функции для расширенного управления
 
-        // Проверка на зависание таймера
-        if (motor_state.is_moving && motor_state.remaining_steps > 0)
-        {
-            // Можно добавить проверку таймаута здесь
-        }
-    }
+void motor_set_step_mode(uint8_t shade, bool half_step)
+{
+    g_motors[shade].use_half_step = half_step;
+    ESP_LOGI(TAG, "Motor %u: step mode set to %s", shade + 1, half_step ? "half-step" : "full-step");
 }
 
-// Дополнительные функции для расширенного управления
+void motor_set_event_callback(motor_event_callback_t callback)
+{
+    g_event_callback = callback;
+}
+
+motor_direction_t motor_get_direction(uint8_t shade)
+{
+    return g_motors[shade].current_direction;
+}
+
+int64_t motor_get_start_time_us(uint8_t shade)
+{
+    return g_motors[shade].start_time_us;
+}
 
-void motor_set_step_mode(bool half_step)
+int32_t motor_get_position_steps(uint8_t shade)
 {
-    motor_state.use_half_step = half_step;
-    ESP_LOGI(TAG, "Step mode set to: %s", half_step ? "half-step" : "full-step");
+    // Абсолютная позиция в шагах от точки отсчета
+    return g_motors[shade].position_steps;
 }
 
-uint32_t motor_get_position_steps(void)
+void motor_set_position_steps(uint8_t shade, int32_t position)
 {
-    // Возвращает текущую позицию в шагах от начала
-    // Для этого нужно добавить счетчик абсолютной позиции
-    return motor_state.current_step;
+    g_motors[shade].position_steps = position;
+    ESP_LOGI(TAG, "Motor %u: position set to %ld steps", shade + 1, position);
 }
 
-void motor_move_degrees(float degrees)
+void motor_move_degrees(uint8_t shade, float degrees)
 {
     // Конвертируем градусы в шаги
     // 360 градусов = STEPS_PER_REVOLUTION шагов
     float steps_f = (degrees * STEPS_PER_REVOLUTION) / 360.0f;
     uint32_t steps = (uint32_t)steps_f;
 
-    motor_step(steps);
+    motor_step(shade, steps);
 }
 
-void motor_move_rotations(float rotations)
+void motor_move_rotations(uint8_t shade, float rotations)
 {
     // Конвертируем обороты в шаги
     uint32_t steps = (uint32_t)(rotations * STEPS_PER_REVOLUTION);
-    motor_step(steps);
+    motor_step(shade, steps);
 }
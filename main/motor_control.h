@@ -16,17 +16,45 @@ extern "C"
         MOTOR_DIR_STOP
     } motor_direction_t;
 
+    // События мотора для подписчиков (контроллера)
+    typedef enum
+    {
+        MOTOR_EVENT_SEGMENT, // Пройден очередной сегмент из CONFIG_MOTOR_SEGMENT_STEPS шагов
+        MOTOR_EVENT_STOPPED  // Движение завершено или остановлено
+    } motor_event_t;
+
+    // Вызывается из контекста таймера шагов или из задачи, остановившей мотор
+    typedef void (*motor_event_callback_t)(uint8_t shade, motor_event_t event, int32_t position_steps);
+
+    // Моторы всех штор платы (CONFIG_SHADE_COUNT), shade - номер шторы с нуля
     void motor_control_init(void);
-    void motor_set_direction(motor_direction_t direction);
-    void motor_set_speed(uint32_t speed);
-    void motor_step(uint32_t steps);
-    bool motor_is_moving(void);
-    void motor_stop(void);
-
-    void motor_set_step_mode(bool half_step);
-    uint32_t motor_get_position_steps(void);
-    void motor_move_degrees(float degrees);
-    void motor_move_rotations(float rotations);
+    void motor_set_direction(uint8_t shade, motor_direction_t direction);
+    void motor_set_speed(uint8_t shade, uint32_t speed);
+    uint32_t motor_get_speed(uint8_t shade);
+    // Наибольшая скорость, при которой интервал между шагами не короче interval_us
+    uint32_t motor_speed_for_step_interval(uint32_t interval_us);
+    // Плавный переход к скорости: одна единица скорости за steps_per_unit шагов
+    void motor_ramp_to_speed(uint8_t shade, uint32_t speed, uint32_t steps_per_unit);
+    // Сократить оставшийся путь текущего движения до steps шагов (для плавной остановки)
+    void motor_limit_remaining_steps(uint8_t shade, uint32_t steps);
+    void motor_step(uint8_t shade, uint32_t steps);
+    // Первые takeup_steps шагов выбирают люфт и не меняют абсолютную позицию
+    void motor_step_compensated(uint8_t shade, uint32_t steps, uint32_t takeup_steps);
+    bool motor_is_moving(uint8_t shade);
+    void motor_stop(uint8_t shade);
+
+    void motor_set_step_mode(uint8_t shade, bool half_step);
+    // Один подписчик на все моторы
+    void motor_set_event_callback(motor_event_callback_t callback);
+    motor_direction_t motor_get_direction(uint8_t shade);
+    // Время запуска последнего движения (esp_timer_get_time)
+    int64_t motor_get_start_time_us(uint8_t shade);
+
+    // Абсолютная позиция в шагах: вниз - увеличение, вверх - уменьшение
+    int32_t motor_get_position_steps(uint8_t shade);
+    void motor_set_position_steps(uint8_t shade, int32_t position);
+    void motor_move_degrees(uint8_t shade, float degrees);
+    void motor_move_rotations(uint8_t shade, float rotations);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,549 @@
+#include "mqtt_command.h"
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+// Текущая позиция разбора в буфере сообщения
+typedef struct
+{
+    const char *p;
+    const char *end;
+} cursor_t;
+
+// Фрагмент сообщения: ссылка на буфер клиента без копирования
+typedef struct
+{
+    const char *data;
+    size_t len;
+} token_t;
+
+static const struct
+{
+    const char *name;
+    mqtt_action_t action;
+} ACTION_NAMES[] = {
+    {"OPEN", MQTT_ACTION_OPEN},
+    {"CLOSE", MQTT_ACTION_CLOSE},
+    {"STOP", MQTT_ACTION_STOP},
+    {"STRIPES_OPEN", MQTT_ACTION_STRIPES_OPEN},
+    {"STRIPES_CLOSED", MQTT_ACTION_STRIPES_CLOSED},
+};
+
+static bool token_equals(token_t token, const char *literal)
+{
+    return strlen(literal) == token.len && memcmp(token.data, literal, token.len) == 0;
+}
+
+// Идентификатор попадает в JSON ответа, поэтому допустимы только безопасные символы
+static bool is_id_char(char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           c == '-' || c == '_' || c == '.' || c == ':';
+}
+
+static bool parse_uint(token_t token, uint64_t max, uint64_t *out)
+{
+    // 19 цифр всегда помещаются в uint64_t
+    if (token.len == 0 || token.len > 19)
+    {
+        return false;
+    }
+
+    uint64_t value = 0;
+    for (size_t i = 0; i < token.len; i++)
+    {
+        char c = token.data[i];
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+        value = value * 10 + (uint64_t)(c - '0');
+    }
+
+    if (value > max)
+    {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+// Число с дробной частью в сотых долях: "37.5" -> 3750. Цифры после второй отбрасываются
+static bool parse_hundredths(token_t token, uint32_t max_whole, uint32_t *out)
+{
+    uint32_t whole = 0;
+    uint32_t fraction = 0;
+    size_t i = 0;
+
+    for (; i < token.len && token.data[i] != '.'; i++)
+    {
+        char c = token.data[i];
+        if (c < '0' || c > '9' || i >= 7)
+        {
+            return false;
+        }
+        whole = whole * 10 + (uint32_t)(c - '0');
+    }
+
+    if (i == 0)
+    {
+        return false;
+    }
+
+    uint32_t scale = 10;
+    for (i++; i < token.len; i++)
+    {
+        char c = token.data[i];
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+        fraction += (uint32_t)(c - '0') * scale;
+        scale /= 10;
+    }
+
+    uint32_t value = whole * 100 + fraction;
+    if (value > max_whole * 100)
+    {
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+static mqtt_command_status_t command_set_action(mqtt_command_t *command, mqtt_action_t action)
+{
+    if (command->action != MQTT_ACTION_NONE && command->action != action)
+    {
+        return MQTT_COMMAND_ERR_CONFLICT;
+    }
+    command->action = action;
+    return MQTT_COMMAND_OK;
+}
+
+static mqtt_command_status_t command_set_action_name(mqtt_command_t *command, token_t name)
+{
+    for (size_t i = 0; i < sizeof(ACTION_NAMES) / sizeof(ACTION_NAMES[0]); i++)
+    {
+        if (strlen(ACTION_NAMES[i].name) == name.len && strncasecmp(name.data, ACTION_NAMES[i].name, name.len) == 0)
+        {
+            return command_set_action(command, ACTION_NAMES[i].action);
+        }
+    }
+    return MQTT_COMMAND_ERR_FIELD;
+}
+
+static mqtt_command_status_t command_set_field(mqtt_command_t *command, token_t key, token_t value)
+{
+    uint64_t number = 0;
+    uint32_t hundredths = 0;
+
+    if (token_equals(key, "id"))
+    {
+        if (value.len == 0 || value.len > MQTT_COMMAND_ID_MAX)
+        {
+            return MQTT_COMMAND_ERR_RANGE;
+        }
+        for (size_t i = 0; i < value.len; i++)
+        {
+            if (!is_id_char(value.data[i]))
+            {
+                return MQTT_COMMAND_ERR_RANGE;
+            }
+        }
+        memcpy(command->id, value.data, value.len);
+        command->id[value.len] = '\0';
+        return MQTT_COMMAND_OK;
+    }
+
+    if (token_equals(key, "cmd"))
+    {
+        return command_set_action_name(command, value);
+    }
+
+    if (token_equals(key, "position"))
+    {
+        if (!parse_hundredths(value, 100, &hundredths))
+        {
+            return MQTT_COMMAND_ERR_RANGE;
+        }
+        command->position_100ths = (uint16_t)hundredths;
+        return command_set_action(command, MQTT_ACTION_POSITION);
+    }
+
+    if (token_equals(key, "position100ths"))
+    {
+        if (!parse_uint(value, 10000, &number))
+        {
+            return MQTT_COMMAND_ERR_RANGE;
+        }
+        command->position_100ths = (uint16_t)number;
+        return command_set_action(command, MQTT_ACTION_POSITION);
+    }
+
+    if (token_equals(key, "tilt"))
+    {
+        if (!parse_hundredths(value, 100, &hundredths))
+        {
+            return MQTT_COMMAND_ERR_RANGE;
+        }
+        command->tilt_100ths = (uint16_t)hundredths;
+        return command_set_action(command, MQTT_ACTION_TILT);
+    }
+
+    if (token_equals(key, "tilt100ths"))
+    {
+        if (!parse_uint(value, 10000, &number))
+        {
+            return MQTT_COMMAND_ERR_RANGE;
+        }
+        command->tilt_100ths = (uint16_t)number;
+        return command_set_action(command, MQTT_ACTION_TILT);
+    }
+
+    if (token_equals(key, "speed"))
+    {
+        if (!parse_uint(value, 100, &number) || number == 0)
+        {
+            return MQTT_COMMAND_ERR_RANGE;
+        }
+        command->speed = (uint8_t)number;
+        return MQTT_COMMAND_OK;
+    }
+
+    if (token_equals(key, "transition"))
+    {
+        if (!parse_hundredths(value, MQTT_COMMAND_TRANSITION_MAX_S, &hundredths))
+        {
+            return MQTT_COMMAND_ERR_RANGE;
+        }
+        command->transition_ms = hundredths * 10;
+        return MQTT_COMMAND_OK;
+    }
+
+    if (token_equals(key, "at"))
+    {
+        if (!parse_uint(value, INT64_MAX, &number))
+        {
+            return MQTT_COMMAND_ERR_RANGE;
+        }
+        command->start_ms = (int64_t)number;
+        return MQTT_COMMAND_OK;
+    }
+
+    return MQTT_COMMAND_ERR_FIELD;
+}
+
+// Сохраняется первая ошибка команды; остальные поля разбираются дальше, чтобы узнать id
+static void command_update_status(mqtt_command_status_t *status, mqtt_command_status_t result)
+{
+    if (*status == MQTT_COMMAND_OK)
+    {
+        *status = result;
+    }
+}
+
+static void command_finish(const mqtt_command_t *command, mqtt_command_status_t status,
+                           mqtt_command_handler_t handler, void *user_data)
+{
+    if (status == MQTT_COMMAND_OK && command->action == MQTT_ACTION_NONE)
+    {
+        status = MQTT_COMMAND_ERR_NO_ACTION;
+    }
+    handler(command, status, user_data);
+}
+
+// Подмножество JSON: плоские объекты, строки без экранирования, числа без знака
+
+static bool json_is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void json_skip_space(cursor_t *c)
+{
+    while (c->p < c->end && json_is_space(*c->p))
+    {
+        c->p++;
+    }
+}
+
+static bool json_accept(cursor_t *c, char expected)
+{
+    json_skip_space(c);
+    if (c->p < c->end && *c->p == expected)
+    {
+        c->p++;
+        return true;
+    }
+    return false;
+}
+
+static bool json_parse_string(cursor_t *c, token_t *out)
+{
+    if (!json_accept(c, '"'))
+    {
+        return false;
+    }
+
+    const char *start = c->p;
+    while (c->p < c->end && *c->p != '"')
+    {
+        if (*c->p == '\\')
+        {
+            return false;
+        }
+        c->p++;
+    }
+
+    if (c->p == c->end)
+    {
+        return false;
+    }
+
+    out->data = start;
+    out->len = (size_t)(c->p - start);
+    c->p++;
+    return true;
+}
+
+// Значение: строка или число (литерал) до разделителя
+static bool json_parse_value(cursor_t *c, token_t *out)
+{
+    json_skip_space(c);
+    if (c->p < c->end && *c->p == '"')
+    {
+        return json_parse_string(c, out);
+    }
+
+    const char *start = c->p;
+    while (c->p < c->end && *c->p != ',' && *c->p != '}' && !json_is_space(*c->p))
+    {
+        if (*c->p == '{' || *c->p == '[' || *c->p == ']' || *c->p == '"')
+        {
+            return false;
+        }
+        c->p++;
+    }
+
+    out->data = start;
+    out->len = (size_t)(c->p - start);
+    return out->len > 0;
+}
+
+static bool json_parse_object(cursor_t *c, mqtt_command_t *command, mqtt_command_status_t *status)
+{
+    if (!json_accept(c, '{'))
+    {
+        return false;
+    }
+    if (json_accept(c, '}'))
+    {
+        return true;
+    }
+
+    do
+    {
+        token_t key;
+        token_t value;
+        if (!json_parse_string(c, &key) || !json_accept(c, ':') || !json_parse_value(c, &value))
+        {
+            return false;
+        }
+        command_update_status(status, command_set_field(command, key, value));
+    } while (json_accept(c, ','));
+
+    return json_accept(c, '}');
+}
+
+static int json_parse_message(cursor_t *c, mqtt_command_handler_t handler, void *user_data)
+{
+    bool batch = json_accept(c, '[');
+    int count = 0;
+    mqtt_command_t command;
+
+    do
+    {
+        command = {};
+        mqtt_command_status_t status = MQTT_COMMAND_OK;
+
+        if (count == MQTT_COMMAND_BATCH_MAX)
+        {
+            handler(&command, MQTT_COMMAND_ERR_BATCH, user_data);
+            return count;
+        }
+        if (!json_parse_object(c, &command, &status))
+        {
+            handler(&command, MQTT_COMMAND_ERR_SYNTAX, user_data);
+            return count;
+        }
+
+        command_finish(&command, status, handler, user_data);
+        count++;
+    } while (batch && json_accept(c, ','));
+
+    bool closed = !batch || json_accept(c, ']');
+    json_skip_space(c);
+    if (!closed || c->p != c->end)
+    {
+        // Ошибка относится к последней команде: ответ получит ее id
+        handler(&command, MQTT_COMMAND_ERR_SYNTAX, user_data);
+    }
+    return count;
+}
+
+// Формат ключ=значение: поля через пробел или запятую, команды через ';' или перевод строки
+
+static bool text_is_field_separator(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == ',';
+}
+
+static bool text_is_command_separator(char c)
+{
+    return c == ';' || c == '\n';
+}
+
+// Слово без '=': действие или позиция, с необязательным временем старта после '@'
+static mqtt_command_status_t text_set_word(mqtt_command_t *command, token_t word)
+{
+    const char *at = (const char *)memchr(word.data, '@', word.len);
+    if (at != NULL)
+    {
+        token_t start = {at + 1, (size_t)(word.data + word.len - at - 1)};
+        uint64_t start_ms = 0;
+        if (!parse_uint(start, INT64_MAX, &start_ms))
+        {
+            return MQTT_COMMAND_ERR_RANGE;
+        }
+        command->start_ms = (int64_t)start_ms;
+        word.len = (size_t)(at - word.data);
+    }
+
+    if (word.len > 0 && word.data[0] >= '0' && word.data[0] <= '9')
+    {
+        uint32_t hundredths = 0;
+        if (!parse_hundredths(word, 100, &hundredths))
+        {
+            return MQTT_COMMAND_ERR_RANGE;
+        }
+        command->position_100ths = (uint16_t)hundredths;
+        return command_set_action(command, MQTT_ACTION_POSITION);
+    }
+
+    return command_set_action_name(command, word);
+}
+
+// Возвращает false, если в команде нет ни одного поля
+static bool text_parse_command(cursor_t *c, mqtt_command_t *command, mqtt_command_status_t *status)
+{
+    bool found = false;
+
+    while (true)
+    {
+        while (c->p < c->end && text_is_field_separator(*c->p))
+        {
+            c->p++;
+        }
+        if (c->p == c->end)
+        {
+            return found;
+        }
+
+        const char *start = c->p;
+        const char *equals = NULL;
+        while (c->p < c->end && !text_is_field_separator(*c->p))
+        {
+            if (*c->p == '=' && equals == NULL)
+            {
+                equals = c->p;
+            }
+            c->p++;
+        }
+        found = true;
+
+        if (equals != NULL)
+        {
+            token_t key = {start, (size_t)(equals - start)};
+            token_t value = {equals + 1, (size_t)(c->p - equals - 1)};
+            command_update_status(status, command_set_field(command, key, value));
+        }
+        else
+        {
+            token_t word = {start, (size_t)(c->p - start)};
+            command_update_status(status, text_set_word(command, word));
+        }
+    }
+}
+
+static int text_parse_message(cursor_t *c, mqtt_command_handler_t handler, void *user_data)
+{
+    int count = 0;
+
+    while (c->p < c->end)
+    {
+        const char *end = c->p;
+        while (end < c->end && !text_is_command_separator(*end))
+        {
+            end++;
+        }
+
+        cursor_t segment = {c->p, end};
+        c->p = end < c->end ? end + 1 : end;
+
+        mqtt_command_t command = {};
+        mqtt_command_status_t status = MQTT_COMMAND_OK;
+        if (!text_parse_command(&segment, &command, &status))
+        {
+            continue;
+        }
+
+        if (count == MQTT_COMMAND_BATCH_MAX)
+        {
+            handler(&command, MQTT_COMMAND_ERR_BATCH, user_data);
+            return count;
+        }
+
+        command_finish(&command, status, handler, user_data);
+        count++;
+    }
+
+    return count;
+}
+
+int mqtt_command_parse(const char *data, size_t len, mqtt_command_handler_t handler, void *user_data)
+{
+    cursor_t c = {data, data + len};
+
+    json_skip_space(&c);
+    if (c.p < c.end && (*c.p == '{' || *c.p == '['))
+    {
+        return json_parse_message(&c, handler, user_data);
+    }
+    return text_parse_message(&c, handler, user_data);
+}
+
+const char *mqtt_command_status_to_string(mqtt_command_status_t status)
+{
+    switch (status)
+    {
+    case MQTT_COMMAND_OK:
+        return "ok";
+    case MQTT_COMMAND_ERR_SYNTAX:
+        return "syntax";
+    case MQTT_COMMAND_ERR_FIELD:
+        return "field";
+    case MQTT_COMMAND_ERR_RANGE:
+        return "range";
+    case MQTT_COMMAND_ERR_CONFLICT:
+        return "conflict";
+    case MQTT_COMMAND_ERR_NO_ACTION:
+        return "no_action";
+    case MQTT_COMMAND_ERR_BATCH:
+        return "batch";
+    case MQTT_COMMAND_ERR_IMMEDIATE:
+        return "immediate";
+    default:
+        return "unknown";
+    }
+}
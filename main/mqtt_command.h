@@ -0,0 +1,78 @@
+// components/mqtt_integration/mqtt_command.h
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Наибольшая длина идентификатора команды: буквы, цифры и - _ . :
+#define MQTT_COMMAND_ID_MAX 16
+    // Наибольшее число команд в одном сообщении
+#define MQTT_COMMAND_BATCH_MAX 4
+    // Наибольшее время перехода, с
+#define MQTT_COMMAND_TRANSITION_MAX_S 600
+
+    typedef enum
+    {
+        MQTT_ACTION_NONE,
+        MQTT_ACTION_OPEN,
+        MQTT_ACTION_CLOSE,
+        MQTT_ACTION_STOP,
+        MQTT_ACTION_POSITION,
+        MQTT_ACTION_TILT,
+        MQTT_ACTION_STRIPES_OPEN,
+        MQTT_ACTION_STRIPES_CLOSED
+    } mqtt_action_t;
+
+    // Разобранная команда. Позиция и наклон - в терминах Home Assistant (10000 - открыто)
+    typedef struct
+    {
+        mqtt_action_t action;
+        uint16_t position_100ths;
+        uint16_t tilt_100ths;
+        uint8_t speed;          // 1-100, 0 - выученная скорость
+        uint32_t transition_ms; // Время движения, 0 - без ограничения
+        int64_t start_ms;       // Время старта UNIX, 0 - сразу
+        char id[MQTT_COMMAND_ID_MAX + 1];
+    } mqtt_command_t;
+
+    typedef enum
+    {
+        MQTT_COMMAND_OK,
+        MQTT_COMMAND_ERR_SYNTAX,    // Сообщение не разобрано, следующие команды пропущены
+        MQTT_COMMAND_ERR_FIELD,     // Неизвестное поле или действие
+        MQTT_COMMAND_ERR_RANGE,     // Значение вне допустимого диапазона
+        MQTT_COMMAND_ERR_CONFLICT,  // Несколько действий в одной команде
+        MQTT_COMMAND_ERR_NO_ACTION, // В команде нет действия
+        MQTT_COMMAND_ERR_BATCH,     // Превышено число команд в сообщении
+        MQTT_COMMAND_ERR_IMMEDIATE  // Больше одной команды, запускаемой сразу (решает вызывающий)
+    } mqtt_command_status_t;
+
+    // Вызывается для каждой команды сообщения по порядку. При ошибке в command
+    // заполнены поля, разобранные до нее (в том числе id, если он встретился)
+    typedef void (*mqtt_command_handler_t)(const mqtt_command_t *command, mqtt_command_status_t status,
+                                           void *user_data);
+
+    // Разбор сообщения прямо в буфере клиента, без копирования и выделения памяти.
+    // Форматы:
+    //   OPEN, 50, CLOSE@<время UNIX, мс>              - прежний формат
+    //   id=k1 position=37.5 speed=40; id=k2 tilt=100  - ключ=значение, команды через ';' или перевод строки
+    //   {"id":"k1","position":37.5,"transition":8}    - подмножество JSON: плоский объект
+    //   [{"cmd":"CLOSE","at":1735689600000},{...}]    - массив объектов
+    // Поля: id, cmd (OPEN, CLOSE, STOP, STRIPES_OPEN, STRIPES_CLOSED), position (0-100),
+    // position100ths (0-10000), tilt (0-100), tilt100ths (0-10000), speed (1-100),
+    // transition (с), at (время старта UNIX, мс). Возвращает число команд.
+    // Разбор ничего не выполняет и не хранит: чтобы выполнить пакет целиком или
+    // не выполнять вовсе, вызывающий проверяет сообщение первым проходом и
+    // выполняет вторым
+    int mqtt_command_parse(const char *data, size_t len, mqtt_command_handler_t handler, void *user_data);
+
+    const char *mqtt_command_status_to_string(mqtt_command_status_t status);
+
+#ifdef __cplusplus
+}
+#endif
@@ -6,7 +6,26 @@
 #include "freertos/semphr.h"
 #include "esp_mac.h"
 #include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "esp_netif.h"
 #include "controller.h"
+#include "mqtt_command.h"
+#ifdef CONFIG_WIFI_POWER_SAVE
+#include "wifi_station.h"
+#endif
+#ifdef CONFIG_MQTT_USE_SSL
+#include "esp_transport_ssl.h"
+#include "esp_crt_bundle.h"
+#include "mbedtls/ssl_ciphersuites.h"
+#endif
+#ifdef CONFIG_MQTT_GROUP_COMMANDS
+#include "esp_netif_sntp.h"
+#include <sys/time.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 static const char *TAG = "mqtt_integration";
@@ -14,47 +33,764 @@ static esp_mqtt_client_handle_t mqtt_client = NULL;
 static SemaphoreHandle_t mqtt_mutex = NULL;
 static bool mqtt_connected = false;
 
-// Обработка MQTT команд
-static void mqtt_handle_command(const char *payload, int payload_len)
+// Топики MQTT и Home Assistant описывают одну штору - первую на плате.
+// Остальные шторы управляются через Matter и кнопки
+#define MQTT_SHADE 0
+
+// Топик доступности для Home Assistant. "offline" публикует брокер по Last Will
+#define AVAILABILITY_TOPIC CONFIG_MQTT_TOPIC_POSITION "/availability"
+
+// Переподключение с экспоненциальной задержкой
+static esp_timer_handle_t g_reconnect_timer = NULL;
+static uint32_t g_reconnect_delay_ms = CONFIG_MQTT_RECONNECT_MIN_MS;
+
+// Время от разрыва соединения до восстановления подписки
+static int64_t g_disconnect_time_us = 0;
+// Первое подключение после загрузки уже отмечено в журнале
+static bool g_boot_connected = false;
+static int g_subscribe_msg_id = -1;
+
+#ifdef CONFIG_MQTT_GROUP_COMMANDS
+// Групповые топики: все шторы, этаж, комната на этаже. Публикация в топик
+// группы управляет всеми устройствами группы одним сообщением
+#define GROUP_TOPIC_ALL CONFIG_MQTT_GROUP_TOPIC_PREFIX "/all/command"
+#define GROUP_TOPIC_FLOOR CONFIG_MQTT_GROUP_TOPIC_PREFIX "/" CONFIG_MQTT_GROUP_FLOOR "/command"
+#define GROUP_TOPIC_ROOM CONFIG_MQTT_GROUP_TOPIC_PREFIX "/" CONFIG_MQTT_GROUP_FLOOR "/" CONFIG_MQTT_GROUP_ROOM "/command"
+#define GROUP_HAS_FLOOR (sizeof(CONFIG_MQTT_GROUP_FLOOR) > 1)
+#define GROUP_HAS_ROOM (GROUP_HAS_FLOOR && sizeof(CONFIG_MQTT_GROUP_ROOM) > 1)
+
+// Часы считаются синхронизированными после 2023 года
+#define TIME_SYNCED_MIN_SEC 1700000000
+
+// Отложенные команды: по слоту на команду сообщения. Сработавшая команда
+// уходит в очередь контроллера копией, слот можно сразу занимать заново
+typedef struct
+{
+    esp_timer_handle_t timer;
+    mqtt_command_t command;
+} scheduled_command_t;
+
+static scheduled_command_t g_scheduled[MQTT_COMMAND_BATCH_MAX];
+#endif
+
+// Время установки соединения (TCP/TLS + CONNECT)
+static int64_t g_connect_start_us = 0;
+
+#ifdef CONFIG_MQTT_USE_SSL
+#ifdef CONFIG_MQTT_TLS_PREFER_HW_CIPHERS
+// AES-GCM и SHA-256 выполняются аппаратно (CONFIG_MBEDTLS_HARDWARE_AES/SHA)
+static const int g_tls_ciphersuites[] = {
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA256,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA256,
+    MBEDTLS_TLS_RSA_WITH_AES_128_GCM_SHA256,
+    0};
+#endif
+
+// TLS транспорт создается один раз и переживает переподключения: в нем хранится
+// тикет сессии, поэтому повторное подключение не требует полного рукопожатия
+static esp_transport_handle_t mqtt_create_tls_transport(void)
+{
+    esp_transport_handle_t transport = esp_transport_ssl_init();
+    if (transport == NULL)
+    {
+        return NULL;
+    }
+
+    esp_transport_set_default_port(transport, CONFIG_MQTT_BROKER_PORT);
+
+    // Корневые сертификаты из встроенного во flash набора
+    esp_transport_ssl_crt_bundle_attach(transport, esp_crt_bundle_attach);
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    esp_transport_ssl_session_tickets_enable(transport);
+#endif
+#ifdef CONFIG_MQTT_TLS_PREFER_HW_CIPHERS
+    esp_transport_ssl_set_ciphersuites_list(transport, g_tls_ciphersuites);
+#endif
+
+    return transport;
+}
+#endif
+
+#ifdef CONFIG_MQTT_HA_DISCOVERY_ENABLED
+// Конфигурация discovery собирается в конце файла
+static void mqtt_discovery_prepare(void);
+static void mqtt_discovery_on_published(int msg_id);
+#endif
+
+// Последнее опубликованное состояние для публикации по изменениям
+typedef struct
+{
+    int position; // Позиция в терминах Home Assistant (100 - открыто), -1 - не публиковалась
+    int64_t position_time_us;
+    state_t state;
+    controller_fault_t fault;
+} mqtt_publisher_t;
+
+static mqtt_publisher_t g_publisher = {-1, 0, IDLE, CONTROLLER_FAULT_NONE};
+
+// Исходящие сообщения состояния: по одному слоту на топик. Новое значение
+// заменяет неотправленное старое, поэтому долгий обрыв связи не расходует
+// память, а после переподключения уходит одно сообщение на топик
+#define OUTBOX_PAYLOAD_MAX 112
+
+typedef enum
+{
+    OUTBOX_POSITION,
+    OUTBOX_MOVEMENT,
+    OUTBOX_STATE,
+    OUTBOX_FAULT,
+    OUTBOX_SLOT_COUNT
+} outbox_slot_t;
+
+typedef struct
+{
+    const char *topic;
+    bool retain;
+    bool pending;
+    uint8_t len;
+    char payload[OUTBOX_PAYLOAD_MAX];
+} outbox_entry_t;
+
+static outbox_entry_t g_outbox[OUTBOX_SLOT_COUNT] = {
+    {CONFIG_MQTT_TOPIC_POSITION, false},
+    {CONFIG_MQTT_TOPIC_MOVEMENT, false},
+    {CONFIG_MQTT_TOPIC_STATE, true},
+    {CONFIG_MQTT_TOPIC_FAULT, true},
+};
+static SemaphoreHandle_t g_outbox_mutex = NULL;
+
+#ifdef CONFIG_MQTT_JSON_STATE
+// Буфер JSON состояния. Заполняется под mqtt_mutex, без выделения памяти
+#define STATE_JSON_MAX_LEN OUTBOX_PAYLOAD_MAX
+static char g_state_json[STATE_JSON_MAX_LEN];
+#endif
+
+// Отправка всех ожидающих сообщений одной пачкой
+static void mqtt_outbox_flush(void)
+{
+    if (g_outbox_mutex == NULL || xSemaphoreTake(g_outbox_mutex, pdMS_TO_TICKS(100)) != pdTRUE)
+    {
+        return;
+    }
+
+    uint8_t sent = 0;
+    for (uint8_t i = 0; i < OUTBOX_SLOT_COUNT && mqtt_connected; i++)
+    {
+        outbox_entry_t *entry = &g_outbox[i];
+        if (!entry->pending)
+        {
+            continue;
+        }
+
+        int msg_id = esp_mqtt_client_enqueue(mqtt_client, entry->topic, entry->payload, entry->len, 1, entry->retain, true);
+        if (msg_id == -1)
+        {
+            ESP_LOGW(TAG, "Failed to enqueue %s, keeping it pending", entry->topic);
+            break;
+        }
+
+        entry->pending = false;
+        sent++;
+    }
+
+    xSemaphoreGive(g_outbox_mutex);
+
+    if (sent > 1)
+    {
+        ESP_LOGD(TAG, "Outbox flushed: %u messages", sent);
+    }
+}
+
+// Постановка сообщения в слот топика. Без связи сообщение ждет переподключения
+static esp_err_t mqtt_outbox_put(outbox_slot_t slot, const char *payload, size_t len)
+{
+    if (len > OUTBOX_PAYLOAD_MAX)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (g_outbox_mutex == NULL || xSemaphoreTake(g_outbox_mutex, pdMS_TO_TICKS(100)) != pdTRUE)
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    outbox_entry_t *entry = &g_outbox[slot];
+    if (entry->pending)
+    {
+        ESP_LOGD(TAG, "Replacing unsent message on %s", entry->topic);
+    }
+    memcpy(entry->payload, payload, len);
+    entry->len = (uint8_t)len;
+    entry->pending = true;
+
+    xSemaphoreGive(g_outbox_mutex);
+
+    if (mqtt_connected)
+    {
+        mqtt_outbox_flush();
+    }
+    return ESP_OK;
+}
+
+// Передача команды управления в задачу контроллера. Позиция и наклон в командах -
+// в терминах Home Assistant (100% - открыто), контроллер считает от верхнего положения
+static esp_err_t mqtt_execute_command(const mqtt_command_t *command)
+{
+    controller_request_t request = {};
+    request.shade = MQTT_SHADE;
+    request.limits.speed = command->speed;
+    request.limits.transition_ms = command->transition_ms;
+    bool limited = command->speed != 0 || command->transition_ms != 0;
+
+    switch (command->action)
+    {
+    case MQTT_ACTION_OPEN:
+    case MQTT_ACTION_CLOSE:
+        // С ограничениями - движение к крайней позиции, без них - до концевого положения
+        if (limited)
+        {
+            request.kind = CONTROLLER_REQUEST_POSITION;
+            request.percentage = command->action == MQTT_ACTION_OPEN ? 0.0f : 100.0f;
+        }
+        else
+        {
+            request.kind = command->action == MQTT_ACTION_OPEN ? CONTROLLER_REQUEST_MOVE_UP
+                                                               : CONTROLLER_REQUEST_MOVE_DOWN;
+        }
+        break;
+
+    case MQTT_ACTION_STOP:
+        request.kind = CONTROLLER_REQUEST_STOP;
+        break;
+
+    case MQTT_ACTION_POSITION:
+        request.kind = CONTROLLER_REQUEST_POSITION;
+        request.percentage = 100.0f - command->position_100ths / 100.0f;
+        break;
+
+    case MQTT_ACTION_TILT:
+        request.kind = CONTROLLER_REQUEST_TILT;
+        request.percentage = 100.0f - command->tilt_100ths / 100.0f;
+        break;
+
+    // Совмещенные полосы - наклон 0%, перекрытые - 100%
+    case MQTT_ACTION_STRIPES_OPEN:
+    case MQTT_ACTION_STRIPES_CLOSED:
+        request.kind = CONTROLLER_REQUEST_TILT;
+        request.percentage = command->action == MQTT_ACTION_STRIPES_OPEN ? 0.0f : 100.0f;
+        break;
+
+    default:
+        return ESP_OK;
+    }
+
+    return controller_post_request(&request);
+}
+
+// Сообщение выполняется целиком или не выполняется вовсе. Предварительный
+// проход проверяет все команды и решает, какие из них запустятся сразу.
+// Каждая немедленная команда движения отменяет предыдущую, поэтому такая
+// команда в сообщении допустима только одна
+typedef struct
+{
+    const char *error;     // Первая ошибка сообщения, NULL - сообщение принято
+    mqtt_command_t failed; // Команда с ошибкой: ответ получит ее id
+    uint8_t count;
+    uint8_t immediate;
+    int64_t delay_ms[MQTT_COMMAND_BATCH_MAX]; // Задержка старта, 0 - сразу
+} command_plan_t;
+
+// Разбор одного сообщения с командами
+typedef struct
+{
+    int64_t receive_time_us;
+    uint8_t index;     // Номер команды в сообщении
+    bool power_saving; // Сообщение пришло в режиме экономии Wi-Fi
+    const command_plan_t *plan;
+} command_context_t;
+
+// MAC устройства в ответах: на групповую команду отвечают все шторы группы
+// в один топик, и ответы различаются только этим полем
+#define COMMAND_RESPONSE_MAX_LEN 144
+static char g_device_id[13];
+
+// Ответ на команду с идентификатором: статус и время от приема до передачи контроллеру
+static void mqtt_publish_command_response(const mqtt_command_t *command, const char *status,
+                                          const char *error, const command_context_t *context)
+{
+    if (command->id[0] == '\0' || !mqtt_connected)
+    {
+        return;
+    }
+
+    char payload[COMMAND_RESPONSE_MAX_LEN];
+    int len;
+    if (error != NULL)
+    {
+        len = snprintf(payload, sizeof(payload),
+                       "{\"id\":\"%s\",\"device\":\"%s\",\"status\":\"%s\",\"error\":\"%s\"}", command->id,
+                       g_device_id, status, error);
+    }
+    else
+    {
+        // Режим питания при приеме позволяет сравнить задержку команд в покое и на ходу
+        len = snprintf(payload, sizeof(payload),
+                       "{\"id\":\"%s\",\"device\":\"%s\",\"status\":\"%s\",\"latency_us\":%lld,\"power_save\":%s}",
+                       command->id, g_device_id, status, esp_timer_get_time() - context->receive_time_us,
+                       context->power_saving ? "true" : "false");
+    }
+    if (len < 0 || len >= (int)sizeof(payload))
+    {
+        ESP_LOGE(TAG, "Command response truncated");
+        return;
+    }
+
+    esp_mqtt_client_enqueue(mqtt_client, CONFIG_MQTT_TOPIC_COMMAND_RESPONSE, payload, len, 0, false, true);
+}
+
+#ifdef CONFIG_MQTT_GROUP_COMMANDS
+// Задача esp_timer не должна ждать мотор и мьютексы подписчиков: команда
+// выполняется в задаче контроллера, как и события кнопок
+static void mqtt_schedule_timer_cb(void *arg)
+{
+    scheduled_command_t *slot = (scheduled_command_t *)arg;
+
+    ESP_LOGI(TAG, "Starting scheduled command %s", slot->command.id);
+    if (mqtt_execute_command(&slot->command) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Scheduled command %s dropped", slot->command.id);
+    }
+}
+
+// Текущее время UNIX в мс или 0, если часы еще не синхронизированы по SNTP
+static int64_t mqtt_unix_time_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec < TIME_SYNCED_MIN_SEC)
+    {
+        return 0;
+    }
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void mqtt_cancel_scheduled_commands(void)
+{
+    for (uint8_t i = 0; i < MQTT_COMMAND_BATCH_MAX; i++)
+    {
+        esp_timer_stop(g_scheduled[i].timer);
+    }
+}
+
+typedef enum
+{
+    SCHEDULE_NOW,
+    SCHEDULE_LATER,
+    SCHEDULE_STALE
+} schedule_result_t;
+
+// Старт по метке времени: все шторы группы трогаются одновременно. Без
+// синхронизированных часов, с наступившим или слишком далеким временем
+// команда запускается сразу
+static schedule_result_t mqtt_plan_command(const mqtt_command_t *command, int64_t *delay_ms)
+{
+    *delay_ms = 0;
+
+    int64_t now_ms = mqtt_unix_time_ms();
+    if (now_ms == 0)
+    {
+        ESP_LOGW(TAG, "Clock not synchronized, scheduled command starts now");
+        return SCHEDULE_NOW;
+    }
+
+    int64_t delay = command->start_ms - now_ms;
+
+    // Команда, пролежавшая у брокера дольше допустимого, устарела
+    if (-delay > CONFIG_MQTT_SCHEDULE_MAX_DELAY_MS)
+    {
+        ESP_LOGW(TAG, "Stale command (%lld ms late)", -delay);
+        return SCHEDULE_STALE;
+    }
+    if (delay <= 0)
+    {
+        return SCHEDULE_NOW;
+    }
+    if (delay > CONFIG_MQTT_SCHEDULE_MAX_DELAY_MS)
+    {
+        ESP_LOGW(TAG, "Scheduled start %lld ms ahead exceeds limit, starts now", delay);
+        return SCHEDULE_NOW;
+    }
+
+    *delay_ms = delay;
+    return SCHEDULE_LATER;
+}
+
+static void mqtt_schedule_command(const mqtt_command_t *command, uint8_t slot, int64_t delay_ms)
+{
+    g_scheduled[slot].command = *command;
+    esp_timer_start_once(g_scheduled[slot].timer, (uint64_t)delay_ms * 1000);
+
+    ESP_LOGI(TAG, "Command scheduled in %lld ms", delay_ms);
+}
+#endif
+
+// Предварительный проход: ничего не выполняет
+static void mqtt_command_plan_handler(const mqtt_command_t *command, mqtt_command_status_t status, void *user_data)
+{
+    command_plan_t *plan = (command_plan_t *)user_data;
+    uint8_t index = plan->count++;
+
+    if (plan->error != NULL)
+    {
+        return;
+    }
+
+    const char *error = status != MQTT_COMMAND_OK ? mqtt_command_status_to_string(status) : NULL;
+    int64_t delay_ms = 0;
+
+    if (error == NULL && command->start_ms != 0)
+    {
+#ifdef CONFIG_MQTT_GROUP_COMMANDS
+        if (mqtt_plan_command(command, &delay_ms) == SCHEDULE_STALE)
+        {
+            error = "stale";
+        }
+#else
+        ESP_LOGW(TAG, "Scheduled start requires group commands, command starts now");
+#endif
+    }
+
+    if (error == NULL && delay_ms == 0 && ++plan->immediate > 1)
+    {
+        error = mqtt_command_status_to_string(MQTT_COMMAND_ERR_IMMEDIATE);
+    }
+
+    if (error != NULL)
+    {
+        plan->error = error;
+        plan->failed = *command;
+        return;
+    }
+    plan->delay_ms[index] = delay_ms;
+}
+
+static void mqtt_command_handler(const mqtt_command_t *command, mqtt_command_status_t status, void *user_data)
+{
+    command_context_t *context = (command_context_t *)user_data;
+    uint8_t index = context->index++;
+
+    // Повторный разбор того же сообщения: ошибки отсеяны предварительным проходом
+    if (status != MQTT_COMMAND_OK || index >= MQTT_COMMAND_BATCH_MAX)
+    {
+        return;
+    }
+
+    ESP_LOGI(TAG, "MQTT command %u: action %d", index, command->action);
+
+#ifdef CONFIG_MQTT_GROUP_COMMANDS
+    int64_t delay_ms = context->plan->delay_ms[index];
+    if (delay_ms > 0)
+    {
+        mqtt_schedule_command(command, index, delay_ms);
+        mqtt_publish_command_response(command, "scheduled", NULL, context);
+        return;
+    }
+#endif
+
+    if (mqtt_execute_command(command) != ESP_OK)
+    {
+        mqtt_publish_command_response(command, "rejected", "busy", context);
+        return;
+    }
+    mqtt_publish_command_response(command, "accepted", NULL, context);
+}
+
+// Обработка MQTT команд: разбор прямо в буфере клиента, без копирования.
+// Разбор дешевый, поэтому сообщение разбирается дважды: проверка и выполнение,
+// без буфера под разобранные команды
+static void mqtt_handle_command(const char *payload, int payload_len, int64_t receive_time_us)
+{
+    if (payload_len <= 0)
+        return;
+
+    command_plan_t plan = {};
+    mqtt_command_parse(payload, (size_t)payload_len, mqtt_command_plan_handler, &plan);
+
+    command_context_t context = {receive_time_us, 0, false, &plan};
+#ifdef CONFIG_WIFI_POWER_SAVE
+    context.power_saving = wifi_station_is_power_saving();
+#endif
+
+    // Отклоненное сообщение не трогает ни движение, ни отложенные команды
+    if (plan.error != NULL)
+    {
+        ESP_LOGW(TAG, "Rejected MQTT message: %s", plan.error);
+        mqtt_publish_command_response(&plan.failed, "rejected", plan.error, &context);
+        return;
+    }
+    if (plan.count == 0)
+    {
+        ESP_LOGW(TAG, "Empty MQTT command");
+        return;
+    }
+
+#ifdef CONFIG_MQTT_GROUP_COMMANDS
+    // Новое принятое сообщение отменяет ожидающие отложенные команды
+    mqtt_cancel_scheduled_commands();
+#endif
+
+    mqtt_command_parse(payload, (size_t)payload_len, mqtt_command_handler, &context);
+}
+
+// Контроллер считает 0% верхним положением, Home Assistant - закрытым
+static uint8_t mqtt_position_from_percentage(float percentage)
+{
+    return (uint8_t)(100 - (int)(percentage + 0.5f));
+}
+
+// Состояние cover для Home Assistant
+static const char *mqtt_cover_state(uint8_t position, bool is_moving, bool direction_up)
+{
+    if (is_moving)
+    {
+        return direction_up ? "opening" : "closing";
+    }
+
+    // Промежуточные позиции Home Assistant считает открытыми
+    return position == 0 ? "closed" : "open";
+}
+
+#ifdef CONFIG_MQTT_JSON_STATE
+// Одно сообщение вместо трех: позиция, цель, состояние, направление, неисправность
+static esp_err_t mqtt_publish_json_state_locked(uint8_t position)
+{
+    state_t state = g_publisher.state;
+    bool is_moving = state == MOVING_UP || state == MOVING_DOWN;
+    bool direction_up = state == MOVING_UP;
+    uint8_t target = mqtt_position_from_percentage(controller_get_target_percentage(MQTT_SHADE));
+
+    int len = snprintf(g_state_json, sizeof(g_state_json),
+                       "{\"position\":%u,\"target\":%u,\"state\":\"%s\",\"direction\":\"%s\",\"fault\":\"%s\"}",
+                       position, target, mqtt_cover_state(position, is_moving, direction_up),
+                       is_moving ? (direction_up ? "up" : "down") : "none",
+                       controller_fault_to_string(g_publisher.fault));
+    if (len < 0 || len >= (int)sizeof(g_state_json))
+    {
+        ESP_LOGE(TAG, "State JSON truncated");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_err_t err = mqtt_outbox_put(OUTBOX_STATE, g_state_json, len);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to publish state");
+        return err;
+    }
+
+    ESP_LOGD(TAG, "State published to topic %s: %s", CONFIG_MQTT_TOPIC_STATE, g_state_json);
+    return ESP_OK;
+}
+#endif
+
+static void mqtt_publish_position_locked(uint8_t position)
+{
+#ifdef CONFIG_MQTT_JSON_STATE
+    esp_err_t err = mqtt_publish_json_state_locked(position);
+#else
+    esp_err_t err = mqtt_integration_publish_position(position);
+#endif
+    if (err == ESP_OK)
+    {
+        g_publisher.position = position;
+        g_publisher.position_time_us = esp_timer_get_time();
+    }
+}
+
+static void mqtt_publish_movement_locked(state_t state)
+{
+    uint8_t position = mqtt_position_from_percentage(controller_get_position_percentage(MQTT_SHADE));
+
+#ifdef CONFIG_MQTT_JSON_STATE
+    // Позиция входит в сообщение состояния
+    mqtt_publish_position_locked(position);
+#else
+    bool is_moving = state == MOVING_UP || state == MOVING_DOWN;
+    bool direction_up = state == MOVING_UP;
+
+    mqtt_integration_publish_movement(is_moving, direction_up);
+    mqtt_integration_publish_state(position, is_moving, direction_up);
+#endif
+}
+
+static void mqtt_publish_fault_locked(void)
+{
+#ifdef CONFIG_MQTT_JSON_STATE
+    mqtt_publish_position_locked(mqtt_position_from_percentage(controller_get_position_percentage(MQTT_SHADE)));
+#else
+    mqtt_integration_publish_fault(controller_fault_to_string(g_publisher.fault));
+#endif
+}
+
+// Полное состояние после подключения к брокеру
+static void mqtt_publish_snapshot(void)
+{
+    if (mqtt_mutex == NULL || xSemaphoreTake(mqtt_mutex, pdMS_TO_TICKS(100)) != pdTRUE)
+    {
+        return;
+    }
+
+    g_publisher.state = controller_get_state(MQTT_SHADE);
+    g_publisher.fault = controller_get_fault(MQTT_SHADE);
+#ifdef CONFIG_MQTT_JSON_STATE
+    mqtt_publish_movement_locked(g_publisher.state);
+#else
+    mqtt_publish_fault_locked();
+    mqtt_publish_movement_locked(g_publisher.state);
+    mqtt_publish_position_locked(mqtt_position_from_percentage(controller_get_position_percentage(MQTT_SHADE)));
+#endif
+
+    xSemaphoreGive(mqtt_mutex);
+}
+
+// Старт и остановка движения, неисправности - публикуются сразу
+static void mqtt_controller_state_cb(uint8_t shade, state_t state, controller_fault_t fault, void *user_data)
 {
-    if (payload_len <= 0)
+    if (shade != MQTT_SHADE)
+    {
+        return;
+    }
+
+    if (mqtt_mutex == NULL || xSemaphoreTake(mqtt_mutex, pdMS_TO_TICKS(100)) != pdTRUE)
+    {
         return;
+    }
+
+    bool fault_changed = fault != g_publisher.fault;
+    bool state_changed = state != g_publisher.state;
 
-    // Создаем нуль-терминированную строку из payload
-    char command[32];
-    int copy_len = (payload_len < sizeof(command) - 1) ? payload_len : sizeof(command) - 1;
-    memcpy(command, payload, copy_len);
-    command[copy_len] = '\0';
+    g_publisher.fault = fault;
+    g_publisher.state = state;
 
-    ESP_LOGI(TAG, "Processing MQTT command: %s", command);
+    if (state_changed)
+    {
+        mqtt_publish_movement_locked(state);
+    }
 
-    // Обрабатываем команды от Home Assistant
-    if (strcmp(command, "OPEN") == 0)
+#ifdef CONFIG_MQTT_JSON_STATE
+    // Неисправность уже вошла в сообщение состояния
+    if (fault_changed && !state_changed)
+#else
+    if (fault_changed)
+#endif
     {
-        controller_move_up();
+        mqtt_publish_fault_locked();
     }
-    else if (strcmp(command, "CLOSE") == 0)
+
+    xSemaphoreGive(mqtt_mutex);
+}
+
+// Позиция на ходу - не чаще интервала и не меньше порога изменения,
+// конечная позиция после остановки - сразу
+static void mqtt_controller_position_cb(uint8_t shade, float percentage, bool settled, void *user_data)
+{
+    if (shade != MQTT_SHADE)
     {
-        controller_move_down();
+        return;
     }
-    else if (strcmp(command, "STOP") == 0)
+
+    uint8_t position = mqtt_position_from_percentage(percentage);
+
+    if (mqtt_mutex == NULL || xSemaphoreTake(mqtt_mutex, pdMS_TO_TICKS(100)) != pdTRUE)
     {
-        controller_stop();
+        return;
     }
-    else
+
+    if (settled)
     {
-        // Проверяем, является ли команда числом (позиция в процентах)
-        char *endptr;
-        long position = strtol(command, &endptr, 10);
-        if (*endptr == '\0' && position >= 0 && position <= 100)
-        {
-            controller_set_position_percentage((float)position);
-        }
-        else
+        if (position != g_publisher.position)
         {
-            ESP_LOGW(TAG, "Unknown MQTT command: %s", command);
+            mqtt_publish_position_locked(position);
         }
     }
+    else if (abs((int)position - g_publisher.position) >= CONFIG_MQTT_POSITION_MIN_DELTA &&
+             esp_timer_get_time() - g_publisher.position_time_us >= (int64_t)CONFIG_MQTT_POSITION_MIN_INTERVAL_MS * 1000)
+    {
+        mqtt_publish_position_locked(position);
+    }
+
+    xSemaphoreGive(mqtt_mutex);
+}
+
+static void mqtt_reconnect_timer_cb(void *arg)
+{
+    if (mqtt_client != NULL && !mqtt_connected)
+    {
+        ESP_LOGI(TAG, "Reconnecting to MQTT broker");
+        esp_mqtt_client_reconnect(mqtt_client);
+    }
+}
+
+static void mqtt_schedule_reconnect(void)
+{
+    // Случайная добавка до четверти задержки разносит переподключения
+    // нескольких устройств после перезапуска брокера
+    uint32_t delay_ms = g_reconnect_delay_ms + esp_random() % (g_reconnect_delay_ms / 4 + 1);
+
+    esp_timer_stop(g_reconnect_timer);
+    esp_timer_start_once(g_reconnect_timer, (uint64_t)delay_ms * 1000);
+    ESP_LOGI(TAG, "Next reconnect attempt in %lu ms", delay_ms);
+
+    g_reconnect_delay_ms = g_reconnect_delay_ms * 2 < CONFIG_MQTT_RECONNECT_MAX_MS
+                               ? g_reconnect_delay_ms * 2
+                               : CONFIG_MQTT_RECONNECT_MAX_MS;
+}
+
+// Сеть поднялась: переподключаемся сразу, не дожидаясь таймера
+static void mqtt_ip_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if (mqtt_client != NULL && !mqtt_connected)
+    {
+        g_reconnect_delay_ms = CONFIG_MQTT_RECONNECT_MIN_MS;
+        esp_timer_stop(g_reconnect_timer);
+        mqtt_reconnect_timer_cb(NULL);
+    }
+}
+
+static void mqtt_log_resubscribe_time(void)
+{
+    if (g_disconnect_time_us != 0)
+    {
+        ESP_LOGI(TAG, "Disconnect to resubscribed: %lld ms",
+                 (esp_timer_get_time() - g_disconnect_time_us) / 1000);
+        g_disconnect_time_us = 0;
+    }
+}
+
+static bool mqtt_topic_equals(const char *topic, int topic_len, const char *expected)
+{
+    return topic_len == (int)strlen(expected) && memcmp(topic, expected, topic_len) == 0;
+}
+
+static bool mqtt_is_command_topic(const char *topic, int topic_len)
+{
+    if (mqtt_topic_equals(topic, topic_len, CONFIG_MQTT_TOPIC_COMMAND))
+    {
+        return true;
+    }
+
+#ifdef CONFIG_MQTT_GROUP_COMMANDS
+    if (mqtt_topic_equals(topic, topic_len, GROUP_TOPIC_ALL) ||
+        (GROUP_HAS_FLOOR && mqtt_topic_equals(topic, topic_len, GROUP_TOPIC_FLOOR)) ||
+        (GROUP_HAS_ROOM && mqtt_topic_equals(topic, topic_len, GROUP_TOPIC_ROOM)))
+    {
+        return true;
+    }
+#endif
+
+    return false;
 }
 
 // Обработчик событий MQTT
@@ -64,10 +800,36 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 
     switch (event->event_id)
     {
+    case MQTT_EVENT_BEFORE_CONNECT:
+        g_connect_start_us = esp_timer_get_time();
+        break;
+
     case MQTT_EVENT_CONNECTED:
-        ESP_LOGI(TAG, "MQTT connected");
+        ESP_LOGI(TAG, "MQTT connected in %lld ms, session present: %d",
+                 (esp_timer_get_time() - g_connect_start_us) / 1000, event->session_present);
         mqtt_connected = true;
-        mqtt_integration_subscribe_commands();
+        g_reconnect_delay_ms = CONFIG_MQTT_RECONNECT_MIN_MS;
+
+        if (!g_boot_connected)
+        {
+            g_boot_connected = true;
+            ESP_LOGI(TAG, "Boot: MQTT connected at %lld ms", esp_timer_get_time() / 1000);
+        }
+
+        // Постоянная сессия сохранила подписку и команды, пришедшие без нас
+        if (event->session_present)
+        {
+            mqtt_log_resubscribe_time();
+        }
+        else
+        {
+            mqtt_integration_subscribe_commands();
+        }
+
+        esp_mqtt_client_enqueue(mqtt_client, AVAILABILITY_TOPIC, "online", 0, 1, true, true);
+        // Снимок состояния заменяет накопленные без связи значения, затем все уходит одной пачкой
+        mqtt_publish_snapshot();
+        mqtt_outbox_flush();
 #ifdef CONFIG_MQTT_HA_DISCOVERY_ENABLED
         // Публикуем конфигурацию для Home Assistant
         mqtt_integration_publish_discovery_config();
@@ -76,27 +838,47 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT disconnected");
+        if (mqtt_connected || g_disconnect_time_us == 0)
+        {
+            g_disconnect_time_us = esp_timer_get_time();
+        }
         mqtt_connected = false;
+        mqtt_schedule_reconnect();
+        break;
+
+    case MQTT_EVENT_SUBSCRIBED:
+        if (event->msg_id == g_subscribe_msg_id)
+        {
+            g_subscribe_msg_id = -1;
+            mqtt_log_resubscribe_time();
+        }
+        break;
+
 #ifdef CONFIG_MQTT_HA_DISCOVERY_ENABLED
-        // Публикуем статус недоступности для Home Assistant
-        char availability_topic[256];
-        snprintf(availability_topic, sizeof(availability_topic),
-                 "%s/availability", CONFIG_MQTT_TOPIC_POSITION);
-        // Публикуем статус offline с retain flag
-        esp_mqtt_client_publish(mqtt_client, availability_topic, "offline", 0, 1, true);
-#endif
+    case MQTT_EVENT_PUBLISHED:
+        mqtt_discovery_on_published(event->msg_id);
         break;
+#endif
 
     case MQTT_EVENT_DATA:
+    {
+        int64_t receive_time_us = esp_timer_get_time();
         ESP_LOGI(TAG, "MQTT data received, topic: %.*s", event->topic_len, event->topic);
 
-        // Проверяем является ли это командным топиком
-        if (event->topic_len == strlen(CONFIG_MQTT_TOPIC_COMMAND) &&
-            memcmp(event->topic, CONFIG_MQTT_TOPIC_COMMAND, event->topic_len) == 0)
+        // Команды разбираются целиком: сообщение, разбитое на части, не принимаем
+        if (event->data_len != event->total_data_len)
+        {
+            ESP_LOGW(TAG, "Fragmented MQTT message (%d bytes) ignored", event->total_data_len);
+            break;
+        }
+
+        // Проверяем является ли это командным топиком устройства или группы
+        if (mqtt_is_command_topic(event->topic, event->topic_len))
         {
-            mqtt_handle_command(event->data, event->data_len);
+            mqtt_handle_command(event->data, event->data_len, receive_time_us);
         }
         break;
+    }
 
     default:
         break;
@@ -111,6 +893,11 @@ esp_err_t mqtt_integration_init(void)
         return ESP_ERR_INVALID_STATE;
     }
 
+    uint8_t mac[6];
+    esp_efuse_mac_get_default(mac);
+    snprintf(g_device_id, sizeof(g_device_id), "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4],
+             mac[5]);
+
     // Create mutex
     mqtt_mutex = xSemaphoreCreateMutex();
     if (mqtt_mutex == NULL)
@@ -119,21 +906,47 @@ esp_err_t mqtt_integration_init(void)
         return ESP_ERR_NO_MEM;
     }
 
-    // Form broker URL from configuration
-    char broker_url[128];
-    if (CONFIG_MQTT_USE_SSL)
-    {
-        snprintf(broker_url, sizeof(broker_url), "mqtts://%s:%d", CONFIG_MQTT_BROKER_HOST, CONFIG_MQTT_BROKER_PORT);
-    }
-    else
+    if (g_outbox_mutex == NULL)
     {
-        snprintf(broker_url, sizeof(broker_url), "mqtt://%s:%d", CONFIG_MQTT_BROKER_HOST, CONFIG_MQTT_BROKER_PORT);
+        g_outbox_mutex = xSemaphoreCreateMutex();
+        if (g_outbox_mutex == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to create outbox mutex");
+            vSemaphoreDelete(mqtt_mutex);
+            return ESP_ERR_NO_MEM;
+        }
     }
 
+#ifdef CONFIG_MQTT_HA_DISCOVERY_ENABLED
+    mqtt_discovery_prepare();
+#endif
+
+    // Form broker URL from configuration
+    char broker_url[128];
+#ifdef CONFIG_MQTT_USE_SSL
+    snprintf(broker_url, sizeof(broker_url), "mqtts://%s:%d", CONFIG_MQTT_BROKER_HOST, CONFIG_MQTT_BROKER_PORT);
+#else
+    snprintf(broker_url, sizeof(broker_url), "mqtt://%s:%d", CONFIG_MQTT_BROKER_HOST, CONFIG_MQTT_BROKER_PORT);
+#endif
+
     // Конфигурация MQTT клиента
     esp_mqtt_client_config_t mqtt_config = {
         .broker.address.uri = broker_url,
         .credentials.client_id = CONFIG_MQTT_CLIENT_ID,
+        // Недоступность сообщает брокер: после разрыва соединения мы уже ничего не отправим
+        .session.last_will.topic = AVAILABILITY_TOPIC,
+        .session.last_will.msg = "offline",
+        .session.last_will.qos = 1,
+        .session.last_will.retain = 1,
+#ifdef CONFIG_MQTT_PERSISTENT_SESSION
+        .session.disable_clean_session = true,
+#endif
+        .session.keepalive = CONFIG_MQTT_KEEPALIVE_S,
+        // Переподключение выполняется по своему таймеру с экспоненциальной задержкой
+        .network.disable_auto_reconnect = true,
+        .task.stack_size = CONFIG_MQTT_INTEGRATION_TASK_STACK_SIZE,
+        // Неподтвержденные QoS1 сообщения клиента не растут без ограничений
+        .outbox.limit = CONFIG_MQTT_OUTBOX_LIMIT_BYTES,
     };
 
     // Добавляем аутентификацию если настроена
@@ -148,6 +961,55 @@ esp_err_t mqtt_integration_init(void)
 
     ESP_LOGI(TAG, "MQTT broker: %s, client ID: %s", broker_url, CONFIG_MQTT_CLIENT_ID);
 
+#ifdef CONFIG_MQTT_GROUP_COMMANDS
+    for (uint8_t i = 0; i < MQTT_COMMAND_BATCH_MAX; i++)
+    {
+        esp_timer_create_args_t schedule_timer_args = {
+            .callback = &mqtt_schedule_timer_cb,
+            .arg = &g_scheduled[i],
+            .name = "mqtt_schedule"};
+        if (g_scheduled[i].timer == NULL && esp_timer_create(&schedule_timer_args, &g_scheduled[i].timer) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to create schedule timer");
+            vSemaphoreDelete(mqtt_mutex);
+            return ESP_FAIL;
+        }
+    }
+
+    // Синхронизация часов для одновременного старта группы
+    if (!esp_sntp_enabled())
+    {
+        esp_sntp_config_t sntp_config = ESP_NETIF_SNTP_DEFAULT_CONFIG(CONFIG_MQTT_SNTP_SERVER);
+        sntp_config.wait_for_sync = false;
+        esp_netif_sntp_init(&sntp_config);
+    }
+#endif
+
+    esp_timer_create_args_t reconnect_timer_args = {
+        .callback = &mqtt_reconnect_timer_cb,
+        .name = "mqtt_reconnect"};
+    if (g_reconnect_timer == NULL && esp_timer_create(&reconnect_timer_args, &g_reconnect_timer) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create reconnect timer");
+        vSemaphoreDelete(mqtt_mutex);
+        return ESP_FAIL;
+    }
+
+#ifdef CONFIG_MQTT_USE_SSL
+    // Транспорт переходит во владение клиента: по описанию network.transport
+    // в mqtt_client.h (esp-mqtt из ESP-IDF 5.4) он должен жить все время жизни
+    // клиента и удаляется в esp_mqtt_client_destroy. Поэтому он создается
+    // последним, и сами мы его не удаляем. При ошибке esp_mqtt_client_init
+    // транспорт мог быть уже принят клиентом: утечка безопаснее двойного удаления
+    mqtt_config.network.transport = mqtt_create_tls_transport();
+    if (mqtt_config.network.transport == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create TLS transport");
+        vSemaphoreDelete(mqtt_mutex);
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
     // Создаем MQTT клиент
     mqtt_client = esp_mqtt_client_init(&mqtt_config);
     if (mqtt_client == NULL)
@@ -177,6 +1039,10 @@ esp_err_t mqtt_integration_init(void)
         return ret;
     }
 
+    controller_add_state_callback(mqtt_controller_state_cb, NULL);
+    controller_add_position_callback(mqtt_controller_position_cb, NULL);
+    esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, mqtt_ip_event_handler, NULL);
+
     ESP_LOGI(TAG, "MQTT integration initialized");
     return ESP_OK;
 }
@@ -199,7 +1065,15 @@ esp_err_t mqtt_integration_deinit(void)
     mqtt_integration_remove_discovery_config();
 #endif
 
+    // При штатном отключении брокер Last Will не публикует
+    if (mqtt_connected)
+    {
+        esp_mqtt_client_publish(mqtt_client, AVAILABILITY_TOPIC, "offline", 0, 1, true);
+    }
+
+    esp_event_handler_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, mqtt_ip_event_handler);
     esp_mqtt_client_stop(mqtt_client);
+    esp_timer_stop(g_reconnect_timer);
     esp_mqtt_client_destroy(mqtt_client);
     mqtt_client = NULL;
     mqtt_connected = false;
@@ -214,19 +1088,14 @@ esp_err_t mqtt_integration_deinit(void)
 
 esp_err_t mqtt_integration_publish_position(uint8_t position)
 {
-    if (!mqtt_connected || mqtt_client == NULL)
-    {
-        return ESP_ERR_INVALID_STATE;
-    }
-
     char payload[16];
-    snprintf(payload, sizeof(payload), "%d", position);
+    int len = snprintf(payload, sizeof(payload), "%d", position);
 
-    int msg_id = esp_mqtt_client_publish(mqtt_client, CONFIG_MQTT_TOPIC_POSITION, payload, 0, 1, 0);
-    if (msg_id == -1)
+    esp_err_t err = mqtt_outbox_put(OUTBOX_POSITION, payload, len);
+    if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to publish position");
-        return ESP_FAIL;
+        return err;
     }
 
     ESP_LOGD(TAG, "Position published to topic %s: %s", CONFIG_MQTT_TOPIC_POSITION, payload);
@@ -235,26 +1104,13 @@ esp_err_t mqtt_integration_publish_position(uint8_t position)
 
 esp_err_t mqtt_integration_publish_movement(bool is_moving, bool direction_up)
 {
-    if (!mqtt_connected || mqtt_client == NULL)
-    {
-        return ESP_ERR_INVALID_STATE;
-    }
-
-    char payload[32];
-    if (is_moving)
-    {
-        snprintf(payload, sizeof(payload), "%s", direction_up ? "moving_up" : "moving_down");
-    }
-    else
-    {
-        snprintf(payload, sizeof(payload), "stopped");
-    }
+    const char *payload = is_moving ? (direction_up ? "moving_up" : "moving_down") : "stopped";
 
-    int msg_id = esp_mqtt_client_publish(mqtt_client, CONFIG_MQTT_TOPIC_MOVEMENT, payload, 0, 1, 0);
-    if (msg_id == -1)
+    esp_err_t err = mqtt_outbox_put(OUTBOX_MOVEMENT, payload, strlen(payload));
+    if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to publish movement");
-        return ESP_FAIL;
+        return err;
     }
 
     ESP_LOGD(TAG, "Movement published to topic %s: %s", CONFIG_MQTT_TOPIC_MOVEMENT, payload);
@@ -263,53 +1119,33 @@ esp_err_t mqtt_integration_publish_movement(bool is_moving, bool direction_up)
 
 esp_err_t mqtt_integration_publish_state(uint8_t position, bool is_moving, bool direction_up)
 {
-    if (!mqtt_connected || mqtt_client == NULL)
-    {
-        return ESP_ERR_INVALID_STATE;
-    }
-
-    char state_payload[32];
-
     // Определяем состояние согласно спецификации Home Assistant Cover
-    if (is_moving)
-    {
-        if (direction_up)
-        {
-            snprintf(state_payload, sizeof(state_payload), "opening");
-        }
-        else
-        {
-            snprintf(state_payload, sizeof(state_payload), "closing");
-        }
-    }
-    else
-    {
-        if (position == 0)
-        {
-            snprintf(state_payload, sizeof(state_payload), "closed");
-        }
-        else if (position == 100)
-        {
-            snprintf(state_payload, sizeof(state_payload), "open");
-        }
-        else
-        {
-            // Для промежуточных позиций используем "open" с позиционной информацией
-            snprintf(state_payload, sizeof(state_payload), "open");
-        }
-    }
+    const char *state_payload = mqtt_cover_state(position, is_moving, direction_up);
 
-    int msg_id = esp_mqtt_client_publish(mqtt_client, CONFIG_MQTT_TOPIC_STATE, state_payload, 0, 1, true);
-    if (msg_id == -1)
+    esp_err_t err = mqtt_outbox_put(OUTBOX_STATE, state_payload, strlen(state_payload));
+    if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to publish state");
-        return ESP_FAIL;
+        return err;
     }
 
     ESP_LOGD(TAG, "State published to topic %s: %s", CONFIG_MQTT_TOPIC_STATE, state_payload);
     return ESP_OK;
 }
 
+esp_err_t mqtt_integration_publish_fault(const char *fault)
+{
+    esp_err_t err = mqtt_outbox_put(OUTBOX_FAULT, fault, strlen(fault));
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to publish fault");
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Fault published to topic %s: %s", CONFIG_MQTT_TOPIC_FAULT, fault);
+    return ESP_OK;
+}
+
 esp_err_t mqtt_integration_subscribe_commands(void)
 {
     if (!mqtt_connected || mqtt_client == NULL)
@@ -324,6 +1160,37 @@ esp_err_t mqtt_integration_subscribe_commands(void)
         return ESP_FAIL;
     }
 
+    g_subscribe_msg_id = msg_id;
+
+#ifdef CONFIG_MQTT_GROUP_COMMANDS
+    const char *group_topics[3];
+    int group_count = 0;
+
+    group_topics[group_count++] = GROUP_TOPIC_ALL;
+    if (GROUP_HAS_FLOOR)
+    {
+        group_topics[group_count++] = GROUP_TOPIC_FLOOR;
+    }
+    if (GROUP_HAS_ROOM)
+    {
+        group_topics[group_count++] = GROUP_TOPIC_ROOM;
+    }
+
+    for (int i = 0; i < group_count; i++)
+    {
+        msg_id = esp_mqtt_client_subscribe(mqtt_client, group_topics[i], 1);
+        if (msg_id == -1)
+        {
+            ESP_LOGE(TAG, "Failed to subscribe to group %s", group_topics[i]);
+            return ESP_FAIL;
+        }
+
+        // Подписка восстановлена, когда подтверждена последняя из них
+        g_subscribe_msg_id = msg_id;
+        ESP_LOGI(TAG, "Subscribed to group commands: %s", group_topics[i]);
+    }
+#endif
+
     ESP_LOGI(TAG, "Subscribed to commands: %s", CONFIG_MQTT_TOPIC_COMMAND);
     return ESP_OK;
 }
@@ -334,13 +1201,136 @@ bool mqtt_integration_is_connected(void)
 }
 
 #ifdef CONFIG_MQTT_HA_DISCOVERY_ENABLED
-// Получение уникального идентификатора устройства
-static void get_device_unique_id(char *buffer, size_t buffer_size)
+// Место для последних трех байт MAC в уникальном идентификаторе
+#define MAC_PLACEHOLDER "######"
+#define MAC_PLACEHOLDER_LEN (sizeof(MAC_PLACEHOLDER) - 1)
+#define DEVICE_UNIQUE_ID CONFIG_MQTT_HA_DEVICE_ID "_" MAC_PLACEHOLDER
+
+// Топики состояния в конфигурации Home Assistant
+#ifdef CONFIG_MQTT_JSON_STATE
+#define DISCOVERY_STATE_FIELDS                                        \
+    "\"state_topic\":\"" CONFIG_MQTT_TOPIC_STATE "\","                \
+    "\"value_template\":\"{{ value_json.state }}\","                  \
+    "\"position_topic\":\"" CONFIG_MQTT_TOPIC_STATE "\","             \
+    "\"position_template\":\"{{ value_json.position }}\","            \
+    "\"json_attributes_topic\":\"" CONFIG_MQTT_TOPIC_STATE "\","
+#else
+#define DISCOVERY_STATE_FIELDS                                        \
+    "\"state_topic\":\"" CONFIG_MQTT_TOPIC_STATE "\","                \
+    "\"position_topic\":\"" CONFIG_MQTT_TOPIC_POSITION "\","
+#endif
+
+// Конфигурация собирается из Kconfig при компиляции и хранится во flash,
+// при загрузке подставляется только MAC
+static const char DISCOVERY_TOPIC_TEMPLATE[] =
+    CONFIG_MQTT_HA_DISCOVERY_PREFIX "/cover/" DEVICE_UNIQUE_ID "/config";
+
+static const char DISCOVERY_PAYLOAD_TEMPLATE[] =
+    "{"
+    "\"~\":\"" CONFIG_MQTT_TOPIC_POSITION "\","
+    "\"name\":\"" CONFIG_MQTT_HA_COVER_NAME "\","
+    "\"unique_id\":\"" DEVICE_UNIQUE_ID "_cover\","
+    "\"device\":{"
+    "\"identifiers\":[\"" DEVICE_UNIQUE_ID "\"],"
+    "\"name\":\"" CONFIG_MQTT_HA_DEVICE_NAME "\","
+    "\"model\":\"MatterBlinds ESP32\","
+    "\"manufacturer\":\"MatterBlinds Project\""
+    "},"
+    DISCOVERY_STATE_FIELDS
+    "\"position_open\":100,"
+    "\"position_closed\":0,"
+    "\"set_position_topic\":\"" CONFIG_MQTT_TOPIC_COMMAND "\","
+    "\"command_topic\":\"" CONFIG_MQTT_TOPIC_COMMAND "\","
+    "\"payload_open\":\"OPEN\","
+    "\"payload_close\":\"CLOSE\","
+    "\"payload_stop\":\"STOP\","
+    "\"state_open\":\"open\","
+    "\"state_closed\":\"closed\","
+    "\"state_closing\":\"closing\","
+    "\"state_opening\":\"opening\","
+    "\"availability_topic\":\"~/availability\","
+    "\"payload_available\":\"online\","
+    "\"payload_not_available\":\"offline\""
+    "}";
+
+static char g_discovery_topic[sizeof(DISCOVERY_TOPIC_TEMPLATE)];
+static char g_discovery_payload[sizeof(DISCOVERY_PAYLOAD_TEMPLATE)];
+static uint32_t g_discovery_hash = 0;
+static int g_discovery_msg_id = -1;
+
+static void discovery_patch_mac(char *buffer, const char *suffix)
+{
+    for (char *p = strstr(buffer, MAC_PLACEHOLDER); p != NULL; p = strstr(p + MAC_PLACEHOLDER_LEN, MAC_PLACEHOLDER))
+    {
+        memcpy(p, suffix, MAC_PLACEHOLDER_LEN);
+    }
+}
+
+// Подстановка MAC в шаблоны и расчет хеша конфигурации. Выполняется один раз
+static void mqtt_discovery_prepare(void)
 {
     uint8_t mac[6];
     esp_efuse_mac_get_default(mac);
-    snprintf(buffer, buffer_size, "%s_%02X%02X%02X",
-             CONFIG_MQTT_HA_DEVICE_ID, mac[3], mac[4], mac[5]);
+
+    char suffix[MAC_PLACEHOLDER_LEN + 1];
+    snprintf(suffix, sizeof(suffix), "%02X%02X%02X", mac[3], mac[4], mac[5]);
+
+    memcpy(g_discovery_topic, DISCOVERY_TOPIC_TEMPLATE, sizeof(g_discovery_topic));
+    memcpy(g_discovery_payload, DISCOVERY_PAYLOAD_TEMPLATE, sizeof(g_discovery_payload));
+    discovery_patch_mac(g_discovery_topic, suffix);
+    discovery_patch_mac(g_discovery_payload, suffix);
+
+    g_discovery_hash = esp_rom_crc32_le(0, (const uint8_t *)g_discovery_topic, strlen(g_discovery_topic));
+    g_discovery_hash = esp_rom_crc32_le(g_discovery_hash, (const uint8_t *)g_discovery_payload, strlen(g_discovery_payload));
+}
+
+// Конфигурация с таким хешем уже опубликована и подтверждена брокером
+static bool mqtt_discovery_is_published(void)
+{
+    nvs_handle_t nvs_handle;
+    if (nvs_open("mqtt", NVS_READONLY, &nvs_handle) != ESP_OK)
+    {
+        return false;
+    }
+
+    uint32_t stored_hash = 0;
+    esp_err_t err = nvs_get_u32(nvs_handle, "discovery_hash", &stored_hash);
+    nvs_close(nvs_handle);
+
+    return err == ESP_OK && stored_hash == g_discovery_hash;
+}
+
+static void mqtt_discovery_store_hash(uint32_t hash)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open("mqtt", NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error opening NVS: %s", esp_err_to_name(err));
+        return;
+    }
+
+    if (hash != 0)
+    {
+        nvs_set_u32(nvs_handle, "discovery_hash", hash);
+    }
+    else
+    {
+        nvs_erase_key(nvs_handle, "discovery_hash");
+    }
+    nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+}
+
+// Брокер подтвердил публикацию конфигурации
+static void mqtt_discovery_on_published(int msg_id)
+{
+    if (g_discovery_msg_id != -1 && msg_id == g_discovery_msg_id)
+    {
+        g_discovery_msg_id = -1;
+        mqtt_discovery_store_hash(g_discovery_hash);
+        ESP_LOGI(TAG, "HA discovery config acknowledged, hash %08lx stored", g_discovery_hash);
+    }
 }
 
 // Публикация конфигурации для Home Assistant MQTT Discovery
@@ -352,74 +1342,24 @@ esp_err_t mqtt_integration_publish_discovery_config(void)
         return ESP_ERR_INVALID_STATE;
     }
 
-    char device_unique_id[32];
-    get_device_unique_id(device_unique_id, sizeof(device_unique_id));
-
-    // Формируем топик для конфигурации cover
-    char discovery_topic[256];
-    snprintf(discovery_topic, sizeof(discovery_topic),
-             "%s/cover/%s/config",
-             CONFIG_MQTT_HA_DISCOVERY_PREFIX, device_unique_id);
-
-    // Формируем JSON конфигурацию для Home Assistant
-    char config_payload[1024];
-    snprintf(config_payload, sizeof(config_payload),
-             "{"
-             "\"~\":\"%s\","
-             "\"name\":\"%s\","
-             "\"unique_id\":\"%s_cover\","
-             "\"device\":{"
-             "\"identifiers\":[\"%s\"],"
-             "\"name\":\"%s\","
-             "\"model\":\"MatterBlinds ESP32\","
-             "\"manufacturer\":\"MatterBlinds Project\""
-             "},"
-             "\"position_topic\":\"~/position\","
-             "\"position_open\":100,"
-             "\"position_closed\":0,"
-             "\"set_position_topic\":\"~/command\","
-             "\"command_topic\":\"~/command\","
-             "\"state_topic\":\"~/state\","
-             "\"payload_open\":\"OPEN\","
-             "\"payload_close\":\"CLOSE\","
-             "\"payload_stop\":\"STOP\","
-             "\"state_open\":\"open\","
-             "\"state_closed\":\"closed\","
-             "\"state_closing\":\"closing\","
-             "\"state_opening\":\"opening\","
-             "\"availability_topic\":\"~/availability\","
-             "\"payload_available\":\"online\","
-             "\"payload_not_available\":\"offline\""
-             "}",
-             CONFIG_MQTT_TOPIC_POSITION,
-             CONFIG_MQTT_HA_COVER_NAME,
-             device_unique_id,
-             device_unique_id,
-             CONFIG_MQTT_HA_DEVICE_NAME);
-
-    // Публикуем конфигурацию сretain flag
-    int msg_id = esp_mqtt_client_publish(mqtt_client, discovery_topic, config_payload, 0, 1, true);
-    if (msg_id == -1)
+    // Конфигурация хранится брокером с флагом retain - повторно отправляем только изменения
+    if (mqtt_discovery_is_published())
     {
-        ESP_LOGE(TAG, "Failed to publish discovery config");
-        return ESP_FAIL;
+        ESP_LOGI(TAG, "HA discovery config unchanged, skipping publish");
     }
-
-    ESP_LOGI(TAG, "Published HA discovery config to %s", discovery_topic);
-
-    // Публикуем статус доступности
-    char availability_topic[256];
-    snprintf(availability_topic, sizeof(availability_topic),
-             "%s/availability", CONFIG_MQTT_TOPIC_POSITION);
-
-    int avail_msg_id = esp_mqtt_client_publish(mqtt_client, availability_topic, "online", 0, 1, true);
-    if (avail_msg_id == -1)
+    else
     {
-        ESP_LOGE(TAG, "Failed to publish availability status");
-        return ESP_FAIL;
+        int msg_id = esp_mqtt_client_publish(mqtt_client, g_discovery_topic, g_discovery_payload, 0, 1, true);
+        if (msg_id == -1)
+        {
+            ESP_LOGE(TAG, "Failed to publish discovery config");
+            return ESP_FAIL;
+        }
+
+        g_discovery_msg_id = msg_id;
+        ESP_LOGI(TAG, "Published HA discovery config to %s", g_discovery_topic);
     }
 
-    ESP_LOGI(TAG, "Published HA availability status to %s", availability_topic);
     return ESP_OK;
 }
 
@@ -431,24 +1371,19 @@ esp_err_t mqtt_integration_remove_discovery_config(void)
         return ESP_ERR_INVALID_STATE;
     }
 
-    char device_unique_id[32];
-    get_device_unique_id(device_unique_id, sizeof(device_unique_id));
-
-    // Формируем топик для конфигурации cover
-    char discovery_topic[256];
-    snprintf(discovery_topic, sizeof(discovery_topic),
-             "%s/cover/%s/config",
-             CONFIG_MQTT_HA_DISCOVERY_PREFIX, device_unique_id);
-
     // Публикуем пустое сообщение для удаления конфигурации
-    int msg_id = esp_mqtt_client_publish(mqtt_client, discovery_topic, "", 0, 1, true);
+    int msg_id = esp_mqtt_client_publish(mqtt_client, g_discovery_topic, "", 0, 1, true);
     if (msg_id == -1)
     {
         ESP_LOGE(TAG, "Failed to remove discovery config");
         return ESP_FAIL;
     }
 
-    ESP_LOGI(TAG, "Removed HA discovery config from %s", discovery_topic);
+    // После удаления конфигурация должна быть опубликована заново
+    g_discovery_msg_id = -1;
+    mqtt_discovery_store_hash(0);
+
+    ESP_LOGI(TAG, "Removed HA discovery config from %s", g_discovery_topic);
     return ESP_OK;
 }
 
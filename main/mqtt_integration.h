@@ -14,12 +14,18 @@ extern "C"
     // Деинициализация MQTT клиента
     esp_err_t mqtt_integration_deinit(void);
 
-    // Публикация состояния штор
+    // Публикация состояния штор. Функции публикации ставят сообщение в очередь
+    // и не блокируют вызывающую задачу; без связи для каждого топика хранится
+    // последнее значение до переподключения. Сами публикации выполняются
+    // по уведомлениям контроллера
     esp_err_t mqtt_integration_publish_position(uint8_t position);
 
     // Публикация статуса движения
     esp_err_t mqtt_integration_publish_movement(bool is_moving, bool direction_up);
 
+    // Публикация неисправности ("none", "stall")
+    esp_err_t mqtt_integration_publish_fault(const char *fault);
+
     // Подписка на команды управления
     esp_err_t mqtt_integration_subscribe_commands(void);
 
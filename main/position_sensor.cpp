@@ -8,17 +8,60 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "sdkconfig.h"
+#include <stdio.h>
+#include <string.h>
 
 static const char *TAG = "position_sensor";
-static position_config_t position_config = {0};
+
+#define FILTER_LENGTH 5
+
+// Пины датчика одной шторы
+typedef struct
+{
+    int power_pin;
+    int adc_channel; // Канал ADC1
+} sensor_pins_t;
+
+// Первая штора - меню датчика положения, остальные - меню штор
+static const sensor_pins_t SENSOR_PINS[CONFIG_SHADE_COUNT] = {
+    {POSITION_SENSOR_POWER_PIN, POSITION_SENSOR_ADC_CHANNEL},
+#if CONFIG_SHADE_COUNT >= 2
+    {CONFIG_SHADE2_SENSOR_POWER_PIN, CONFIG_SHADE2_SENSOR_ADC_CHANNEL},
+#endif
+#if CONFIG_SHADE_COUNT >= 3
+    {CONFIG_SHADE3_SENSOR_POWER_PIN, CONFIG_SHADE3_SENSOR_ADC_CHANNEL},
+#endif
+};
+
+typedef struct
+{
+    uint8_t shade;
+    const sensor_pins_t *pins;
+    // Пространство имен NVS: первая штора хранит калибровку под прежним именем
+    char nvs_namespace[16];
+    position_config_t config;
+
+    // Скользящее среднее position_sensor_read
+    uint32_t filter_buffer[FILTER_LENGTH];
+    uint8_t filter_index;
+
+    // Состояние пошаговой калибровки
+    calibration_step_t calibration_step;
+    uint32_t upper_position;
+    uint32_t lower_position;
+    uint32_t travel_steps;
+    uint32_t backlash_steps;
+    int32_t zebra_open_steps;
+    uint32_t zebra_period;
+    uint32_t zebra_phase;
+    bool zebra_enabled;
+} sensor_state_t;
+
+static sensor_state_t g_sensors[CONFIG_SHADE_COUNT];
 static bool sensor_initialized = false;
 
-// Состояние пошаговой калибровки
-static calibration_step_t current_calibration_step = CALIBRATION_STEP_COMPLETE;
-static uint32_t calibration_upper_position = 0;
-static uint32_t calibration_lower_position = 0;
-static uint32_t calibration_zebra_offset = 100;
-static bool calibration_zebra_enabled = false;
+static void position_sensor_load_calibration_data(sensor_state_t *s);
+static void position_sensor_save_calibration_data(sensor_state_t *s);
 
 // Получение описания шага калибровки
 static const char *get_calibration_step_description(calibration_step_t step)
@@ -29,8 +72,12 @@ static const char *get_calibration_step_description(calibration_step_t step)
         return "Установите жалюзи в верхнее положение и нажмите кнопку";
     case CALIBRATION_STEP_LOWER:
         return "Установите жалюзи в нижнее положение и нажмите кнопку";
-    case CALIBRATION_STEP_ZEBRA_OFFSET:
-        return "Установите положение смещения для штор зебра и нажмите кнопку";
+    case CALIBRATION_STEP_BACKLASH:
+        return "Измерение люфта редуктора, подождите";
+    case CALIBRATION_STEP_ZEBRA_OPEN:
+        return "Совместите полосы зебры (просвет) и нажмите кнопку";
+    case CALIBRATION_STEP_ZEBRA_CLOSED:
+        return "Сдвиньте штору до ближайшего перекрытия полос и нажмите кнопку";
     case CALIBRATION_STEP_COMPLETE:
         return "Калибровка завершена";
     default:
@@ -39,49 +86,73 @@ static const char *get_calibration_step_description(calibration_step_t step)
 }
 
 // Внутренние функции для управления питанием
-static void position_sensor_power_on(void)
+static void position_sensor_power_on(const sensor_state_t *s)
 {
-    gpio_set_level(POSITION_SENSOR_POWER_PIN, 1);
+    gpio_set_level((gpio_num_t)s->pins->power_pin, 1);
     vTaskDelay(pdMS_TO_TICKS(POSITION_SENSOR_STABILIZATION_MS));
 }
 
-static void position_sensor_power_off(void)
+static void position_sensor_power_off(const sensor_state_t *s)
 {
-    gpio_set_level(POSITION_SENSOR_POWER_PIN, 0);
+    gpio_set_level((gpio_num_t)s->pins->power_pin, 0);
 }
 
 void position_sensor_init(void)
 {
-    ESP_LOGI(TAG, "Инициализация датчика положения");
-
-    // Инициализация GPIO для питания потенциометра
-    gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << POSITION_SENSOR_POWER_PIN),
-        .mode = GPIO_MODE_OUTPUT,
-        .pull_up_en = GPIO_PULLUP_DISABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE};
-    gpio_config(&io_conf);
-
-    // Изначально выключаем питание
-    gpio_set_level(POSITION_SENSOR_POWER_PIN, 0);
+    ESP_LOGI(TAG, "Инициализация датчиков положения: %d", CONFIG_SHADE_COUNT);
 
     // Инициализация ADC
     adc1_config_width(ADC_WIDTH_BIT_12);
-    adc1_config_channel_atten(POSITION_SENSOR_ADC_CHANNEL, POSITION_SENSOR_ADC_ATTENUATION);
 
-    // Инициализация конфигурации
-    position_config.min_position = 100;  // Минимальное значение ADC
-    position_config.max_position = 3900; // Максимальное значение ADC
-    position_config.current_position = 0;
-    position_config.calibrated = false;
+    for (uint8_t shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        sensor_state_t *s = &g_sensors[shade];
+        memset(s, 0, sizeof(*s));
+        s->shade = shade;
+        s->pins = &SENSOR_PINS[shade];
+        s->calibration_step = CALIBRATION_STEP_COMPLETE;
+        if (shade == 0)
+        {
+            strlcpy(s->nvs_namespace, "position_sensor", sizeof(s->nvs_namespace));
+        }
+        else
+        {
+            snprintf(s->nvs_namespace, sizeof(s->nvs_namespace), "shade%u_sensor", shade + 1);
+        }
+
+        // Инициализация GPIO для питания потенциометра
+        gpio_config_t io_conf = {
+            .pin_bit_mask = (1ULL << s->pins->power_pin),
+            .mode = GPIO_MODE_OUTPUT,
+            .pull_up_en = GPIO_PULLUP_DISABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_DISABLE};
+        gpio_config(&io_conf);
+
+        // Изначально выключаем питание
+        position_sensor_power_off(s);
+
+        adc1_config_channel_atten((adc1_channel_t)s->pins->adc_channel,
+                                  (adc_atten_t)POSITION_SENSOR_ADC_ATTENUATION);
+
+        // Инициализация конфигурации
+        s->config.min_position = 100;  // Минимальное значение ADC
+        s->config.max_position = 3900; // Максимальное значение ADC
+        s->config.current_position = 0;
+        s->config.calibrated = false;
+
+        // Восстанавливаем сохраненную калибровку, чтобы она была доступна сразу после загрузки
+        position_sensor_load_calibration_data(s);
+
+        ESP_LOGI(TAG, "Штора %u: канал ADC1 %d, пин питания %d", shade + 1, s->pins->adc_channel,
+                 s->pins->power_pin);
+    }
 
     sensor_initialized = true;
-    ESP_LOGI(TAG, "Датчик положения инициализирован");
-    ESP_LOGI(TAG, "ADC пин: %d, пин питания: %d", POSITION_SENSOR_ADC_PIN, POSITION_SENSOR_POWER_PIN);
+    ESP_LOGI(TAG, "Датчики положения инициализированы");
 }
 
-uint32_t position_sensor_read(void)
+uint32_t position_sensor_read(uint8_t shade)
 {
     if (!sensor_initialized)
     {
@@ -89,55 +160,91 @@ uint32_t position_sensor_read(void)
         return 0;
     }
 
+    sensor_state_t *s = &g_sensors[shade];
+
     // Включаем питание для измерения
-    position_sensor_power_on();
+    position_sensor_power_on(s);
 
     // Читаем ADC значение
-    int raw_value = adc1_get_raw(POSITION_SENSOR_ADC_CHANNEL);
+    int raw_value = adc1_get_raw((adc1_channel_t)s->pins->adc_channel);
 
     // Выключаем питание
-    position_sensor_power_off();
+    position_sensor_power_off(s);
 
     if (raw_value < 0)
     {
         ESP_LOGE(TAG, "Ошибка чтения ADC");
-        return position_config.current_position;
+        return s->config.current_position;
     }
 
     uint32_t adc_value = (uint32_t)raw_value;
 
     // Временная стабилизация значения (усреднение)
-    static uint32_t filter_buffer[5] = {0};
-    static uint8_t filter_index = 0;
-
-    filter_buffer[filter_index] = adc_value;
-    filter_index = (filter_index + 1) % 5;
+    s->filter_buffer[s->filter_index] = adc_value;
+    s->filter_index = (s->filter_index + 1) % FILTER_LENGTH;
 
     uint32_t sum = 0;
-    for (int i = 0; i < 5; i++)
+    for (int i = 0; i < FILTER_LENGTH; i++)
     {
-        sum += filter_buffer[i];
+        sum += s->filter_buffer[i];
     }
-    adc_value = sum / 5;
+    adc_value = sum / FILTER_LENGTH;
 
     // Ограничиваем диапазон
-    if (adc_value < position_config.min_position)
+    if (adc_value < s->config.min_position)
     {
-        adc_value = position_config.min_position;
+        adc_value = s->config.min_position;
     }
-    else if (adc_value > position_config.max_position)
+    else if (adc_value > s->config.max_position)
     {
-        adc_value = position_config.max_position;
+        adc_value = s->config.max_position;
     }
 
-    position_config.current_position = adc_value;
+    s->config.current_position = adc_value;
 
-    ESP_LOGD(TAG, "Прочитано значение: %lu", adc_value);
+    ESP_LOGD(TAG, "Штора %u: прочитано значение %lu", shade + 1, adc_value);
 
     return adc_value;
 }
 
-void position_sensor_set_calibration(uint32_t min_pos, uint32_t max_pos)
+uint32_t position_sensor_read_raw(uint8_t shade)
+{
+    if (!sensor_initialized)
+    {
+        ESP_LOGE(TAG, "Датчик не инициализирован");
+        return 0;
+    }
+
+    sensor_state_t *s = &g_sensors[shade];
+
+    // Несколько отсчетов за одно включение питания вместо скользящего среднего,
+    // чтобы значение не запаздывало относительно движения
+    position_sensor_power_on(s);
+
+    uint32_t sum = 0;
+    int samples = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int raw_value = adc1_get_raw((adc1_channel_t)s->pins->adc_channel);
+        if (raw_value >= 0)
+        {
+            sum += (uint32_t)raw_value;
+            samples++;
+        }
+    }
+
+    position_sensor_power_off(s);
+
+    if (samples == 0)
+    {
+        ESP_LOGE(TAG, "Ошибка чтения ADC");
+        return s->config.current_position;
+    }
+
+    return sum / samples;
+}
+
+void position_sensor_set_calibration(uint8_t shade, uint32_t min_pos, uint32_t max_pos)
 {
     if (min_pos >= max_pos)
     {
@@ -145,14 +252,15 @@ void position_sensor_set_calibration(uint32_t min_pos, uint32_t max_pos)
         return;
     }
 
-    position_config.min_position = min_pos;
-    position_config.max_position = max_pos;
-    position_config.calibrated = true;
+    sensor_state_t *s = &g_sensors[shade];
+    s->config.min_position = min_pos;
+    s->config.max_position = max_pos;
+    s->config.calibrated = true;
 
-    ESP_LOGI(TAG, "Калибровка установлена: min=%lu, max=%lu", min_pos, max_pos);
+    ESP_LOGI(TAG, "Штора %u: калибровка установлена: min=%lu, max=%lu", shade + 1, min_pos, max_pos);
 }
 
-void position_sensor_calibrate_start(void)
+void position_sensor_calibrate_start(uint8_t shade)
 {
     ESP_LOGI(TAG, "Начало калибровки датчика положения");
 
@@ -163,7 +271,7 @@ void position_sensor_calibrate_start(void)
     uint32_t min_val = 0;
     for (int i = 0; i < 10; i++)
     {
-        min_val += position_sensor_read();
+        min_val += position_sensor_read(shade);
         vTaskDelay(pdMS_TO_TICKS(100));
     }
     min_val /= 10;
@@ -175,42 +283,44 @@ void position_sensor_calibrate_start(void)
     uint32_t max_val = 0;
     for (int i = 0; i < 10; i++)
     {
-        max_val += position_sensor_read();
+        max_val += position_sensor_read(shade);
         vTaskDelay(pdMS_TO_TICKS(100));
     }
     max_val /= 10;
 
-    position_sensor_set_calibration(min_val, max_val);
+    position_sensor_set_calibration(shade, min_val, max_val);
     ESP_LOGI(TAG, "Калибровка завершена");
 }
 
-bool position_sensor_is_calibrated(void)
+bool position_sensor_is_calibrated(uint8_t shade)
 {
-    return position_config.calibrated;
+    return g_sensors[shade].config.calibrated;
 }
 
-float position_sensor_get_percentage(void)
+float position_sensor_get_percentage(uint8_t shade)
 {
-    if (!position_config.calibrated)
+    const position_config_t *config = &g_sensors[shade].config;
+
+    if (!config->calibrated)
     {
-        ESP_LOGW(TAG, "Датчик не откалиброван");
+        ESP_LOGW(TAG, "Штора %u: датчик не откалиброван", shade + 1);
         return 0.0f;
     }
 
-    uint32_t current = position_sensor_read();
+    uint32_t current = position_sensor_read(shade);
 
-    if (current <= position_config.min_position)
+    if (current <= config->min_position)
     {
         return 0.0f;
     }
 
-    if (current >= position_config.max_position)
+    if (current >= config->max_position)
     {
         return 100.0f;
     }
 
-    float percentage = ((float)(current - position_config.min_position) /
-                        (float)(position_config.max_position - position_config.min_position)) *
+    float percentage = ((float)(current - config->min_position) /
+                        (float)(config->max_position - config->min_position)) *
                        100.0f;
 
     ESP_LOGD(TAG, "Позиция: %.1f%% (%lu)", percentage, current);
@@ -219,128 +329,235 @@ float position_sensor_get_percentage(void)
 }
 
 // Новые функции для пошаговой калибровки
-calibration_step_callback_t position_sensor_start_calibration(void)
+calibration_step_callback_t position_sensor_start_calibration(uint8_t shade)
 {
-    ESP_LOGI(TAG, "Starting step-by-step calibration");
+    sensor_state_t *s = &g_sensors[shade];
+
+    ESP_LOGI(TAG, "Shade %u: starting step-by-step calibration", shade + 1);
 
     // Инициализация zebra_enabled из Kconfig
 #ifdef CONFIG_ZEBRA_BLINDS_SUPPORT
-    calibration_zebra_enabled = true;
+    s->zebra_enabled = true;
 #else
-    calibration_zebra_enabled = false;
+    s->zebra_enabled = false;
 #endif
 
     // Загружаем предыдущие значения калибровки
     nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open("position_sensor", NVS_READONLY, &nvs_handle);
+    esp_err_t err = nvs_open(s->nvs_namespace, NVS_READONLY, &nvs_handle);
 
     if (err == ESP_OK)
     {
-        err = nvs_get_u32(nvs_handle, "upper_position", &calibration_upper_position);
+        err = nvs_get_u32(nvs_handle, "upper_position", &s->upper_position);
         if (err != ESP_OK)
-            calibration_upper_position = 0;
+            s->upper_position = 0;
 
-        err = nvs_get_u32(nvs_handle, "lower_position", &calibration_lower_position);
+        err = nvs_get_u32(nvs_handle, "lower_position", &s->lower_position);
         if (err != ESP_OK)
-            calibration_lower_position = 4095;
-
-        err = nvs_get_u32(nvs_handle, "zebra_offset", &calibration_zebra_offset);
-        if (err != ESP_OK)
-            calibration_zebra_offset = 100;
+            s->lower_position = 4095;
 
         nvs_close(nvs_handle);
     }
 
-    current_calibration_step = CALIBRATION_STEP_UPPER;
+    s->calibration_step = CALIBRATION_STEP_UPPER;
 
     ESP_LOGI(TAG, "Calibration started. Zebra support: %s",
-             calibration_zebra_enabled ? "enabled" : "disabled");
+             s->zebra_enabled ? "enabled" : "disabled");
 
     return get_calibration_step_description;
 }
 
-calibration_step_t position_sensor_next_calibration_step(void)
+calibration_step_t position_sensor_next_calibration_step(uint8_t shade)
 {
-    if (current_calibration_step == CALIBRATION_STEP_COMPLETE)
+    sensor_state_t *s = &g_sensors[shade];
+
+    if (s->calibration_step == CALIBRATION_STEP_COMPLETE)
     {
         return CALIBRATION_STEP_COMPLETE;
     }
 
-    switch (current_calibration_step)
+    switch (s->calibration_step)
     {
     case CALIBRATION_STEP_UPPER:
-        current_calibration_step = CALIBRATION_STEP_LOWER;
+        s->calibration_step = CALIBRATION_STEP_LOWER;
         break;
     case CALIBRATION_STEP_LOWER:
-        if (calibration_zebra_enabled)
+        s->calibration_step = CALIBRATION_STEP_BACKLASH;
+        break;
+    case CALIBRATION_STEP_BACKLASH:
+        if (s->zebra_enabled)
         {
-            current_calibration_step = CALIBRATION_STEP_ZEBRA_OFFSET;
+            s->calibration_step = CALIBRATION_STEP_ZEBRA_OPEN;
         }
         else
         {
-            current_calibration_step = CALIBRATION_STEP_COMPLETE;
+            s->calibration_step = CALIBRATION_STEP_COMPLETE;
         }
         break;
-    case CALIBRATION_STEP_ZEBRA_OFFSET:
-        current_calibration_step = CALIBRATION_STEP_COMPLETE;
+    case CALIBRATION_STEP_ZEBRA_OPEN:
+        s->calibration_step = CALIBRATION_STEP_ZEBRA_CLOSED;
+        break;
+    case CALIBRATION_STEP_ZEBRA_CLOSED:
+        s->calibration_step = CALIBRATION_STEP_COMPLETE;
         break;
     default:
-        current_calibration_step = CALIBRATION_STEP_COMPLETE;
+        s->calibration_step = CALIBRATION_STEP_COMPLETE;
         break;
     }
 
-    ESP_LOGI(TAG, "Next calibration step: %d", current_calibration_step);
-    return current_calibration_step;
+    if (s->calibration_step == CALIBRATION_STEP_COMPLETE)
+    {
+        // Сохраняем все данные в NVS
+        position_sensor_save_calibration_data(s);
+    }
+
+    ESP_LOGI(TAG, "Shade %u: next calibration step %d", shade + 1, s->calibration_step);
+    return s->calibration_step;
 }
 
-void position_sensor_save_calibration_step(uint32_t position)
+calibration_step_t position_sensor_get_calibration_step(uint8_t shade)
 {
-    switch (current_calibration_step)
+    return g_sensors[shade].calibration_step;
+}
+
+void position_sensor_save_calibration_step(uint8_t shade, uint32_t position, int32_t position_steps)
+{
+    sensor_state_t *s = &g_sensors[shade];
+
+    switch (s->calibration_step)
     {
     case CALIBRATION_STEP_UPPER:
-        calibration_upper_position = position;
+        s->upper_position = position;
         ESP_LOGI(TAG, "Upper position saved: %lu", position);
         break;
     case CALIBRATION_STEP_LOWER:
-        calibration_lower_position = position;
-        ESP_LOGI(TAG, "Lower position saved: %lu", position);
+        s->lower_position = position;
+        s->travel_steps = position_steps > 0 ? (uint32_t)position_steps : 0;
+        ESP_LOGI(TAG, "Lower position saved: %lu, travel %lu steps", position, s->travel_steps);
 
         // Устанавливаем калибровку в position_sensor
-        if (calibration_upper_position < calibration_lower_position)
+        if (s->upper_position < s->lower_position)
         {
-            position_sensor_set_calibration(calibration_upper_position, calibration_lower_position);
+            position_sensor_set_calibration(shade, s->upper_position, s->lower_position);
         }
         break;
-    case CALIBRATION_STEP_ZEBRA_OFFSET:
-        calibration_zebra_offset = position;
-        ESP_LOGI(TAG, "Zebra offset saved: %lu", position);
+    case CALIBRATION_STEP_ZEBRA_OPEN:
+        s->zebra_open_steps = position_steps;
+        ESP_LOGI(TAG, "Zebra open alignment saved: %ld steps", position_steps);
+        break;
+    case CALIBRATION_STEP_ZEBRA_CLOSED:
+    {
+        // Открытое и закрытое совмещения отстоят на половину периода полос
+        int32_t half_period = position_steps - s->zebra_open_steps;
+        if (half_period < 0)
+            half_period = -half_period;
+
+        if (half_period == 0)
+        {
+            ESP_LOGE(TAG, "Zebra open and closed alignments are equal");
+            break;
+        }
+
+        s->zebra_period = (uint32_t)half_period * 2;
+        int32_t phase = s->zebra_open_steps % (int32_t)s->zebra_period;
+        if (phase < 0)
+            phase += s->zebra_period;
+        s->zebra_phase = (uint32_t)phase;
+        ESP_LOGI(TAG, "Zebra stripes: period %lu steps, phase %lu steps",
+                 s->zebra_period, s->zebra_phase);
         break;
+    }
     case CALIBRATION_STEP_COMPLETE:
         // Сохраняем все данные в NVS
-        position_sensor_save_calibration_data();
+        position_sensor_save_calibration_data(s);
+        break;
+    default:
         break;
     }
 }
 
-uint32_t position_sensor_get_zebra_offset(void)
+uint32_t position_sensor_get_travel_steps(uint8_t shade)
+{
+    return g_sensors[shade].travel_steps;
+}
+
+void position_sensor_set_backlash_steps(uint8_t shade, uint32_t steps)
+{
+    g_sensors[shade].backlash_steps = steps;
+    ESP_LOGI(TAG, "Shade %u: backlash saved: %lu steps", shade + 1, steps);
+}
+
+uint32_t position_sensor_get_backlash_steps(uint8_t shade)
 {
-    return calibration_zebra_offset;
+    return g_sensors[shade].backlash_steps;
 }
 
-uint32_t position_sensor_get_min_position(void)
+uint32_t position_sensor_get_zebra_period_steps(uint8_t shade)
 {
-    return position_config.min_position;
+    return g_sensors[shade].zebra_period;
 }
 
-uint32_t position_sensor_get_max_position(void)
+uint32_t position_sensor_get_zebra_phase_steps(uint8_t shade)
 {
-    return position_config.max_position;
+    return g_sensors[shade].zebra_phase;
 }
 
-static void position_sensor_save_calibration_data(void)
+uint32_t position_sensor_get_min_position(uint8_t shade)
+{
+    return g_sensors[shade].config.min_position;
+}
+
+uint32_t position_sensor_get_max_position(uint8_t shade)
+{
+    return g_sensors[shade].config.max_position;
+}
+
+static void position_sensor_load_calibration_data(sensor_state_t *s)
 {
     nvs_handle_t nvs_handle;
-    esp_err_t err = nvs_open("position_sensor", NVS_READWRITE, &nvs_handle);
+    esp_err_t err = nvs_open(s->nvs_namespace, NVS_READONLY, &nvs_handle);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGI(TAG, "Shade %u: no saved calibration data", s->shade + 1);
+        return;
+    }
+
+    uint32_t upper_position = 0;
+    uint32_t lower_position = 0;
+    if (nvs_get_u32(nvs_handle, "upper_position", &upper_position) == ESP_OK &&
+        nvs_get_u32(nvs_handle, "lower_position", &lower_position) == ESP_OK)
+    {
+        s->upper_position = upper_position;
+        s->lower_position = lower_position;
+        if (upper_position < lower_position)
+        {
+            position_sensor_set_calibration(s->shade, upper_position, lower_position);
+        }
+    }
+
+    if (nvs_get_u32(nvs_handle, "travel_steps", &s->travel_steps) != ESP_OK)
+        s->travel_steps = 0;
+
+    if (nvs_get_u32(nvs_handle, "backlash_steps", &s->backlash_steps) != ESP_OK)
+        s->backlash_steps = 0;
+
+    if (nvs_get_u32(nvs_handle, "zebra_period", &s->zebra_period) != ESP_OK ||
+        nvs_get_u32(nvs_handle, "zebra_phase", &s->zebra_phase) != ESP_OK)
+    {
+        s->zebra_period = 0;
+        s->zebra_phase = 0;
+    }
+
+    nvs_close(nvs_handle);
+
+    ESP_LOGI(TAG, "Shade %u: calibration data loaded from NVS", s->shade + 1);
+}
+
+static void position_sensor_save_calibration_data(sensor_state_t *s)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(s->nvs_namespace, NVS_READWRITE, &nvs_handle);
 
     if (err != ESP_OK)
     {
@@ -348,19 +565,31 @@ static void position_sensor_save_calibration_data(void)
         return;
     }
 
-    err = nvs_set_u32(nvs_handle, "upper_position", calibration_upper_position);
+    err = nvs_set_u32(nvs_handle, "upper_position", s->upper_position);
     if (err != ESP_OK)
         ESP_LOGE(TAG, "Error saving upper position: %s", esp_err_to_name(err));
 
-    err = nvs_set_u32(nvs_handle, "lower_position", calibration_lower_position);
+    err = nvs_set_u32(nvs_handle, "lower_position", s->lower_position);
     if (err != ESP_OK)
         ESP_LOGE(TAG, "Error saving lower position: %s", esp_err_to_name(err));
 
-    err = nvs_set_u32(nvs_handle, "zebra_offset", calibration_zebra_offset);
+    err = nvs_set_u32(nvs_handle, "travel_steps", s->travel_steps);
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Error saving travel steps: %s", esp_err_to_name(err));
+
+    err = nvs_set_u32(nvs_handle, "backlash_steps", s->backlash_steps);
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Error saving backlash: %s", esp_err_to_name(err));
+
+    err = nvs_set_u32(nvs_handle, "zebra_period", s->zebra_period);
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Error saving zebra period: %s", esp_err_to_name(err));
+
+    err = nvs_set_u32(nvs_handle, "zebra_phase", s->zebra_phase);
     if (err != ESP_OK)
-        ESP_LOGE(TAG, "Error saving zebra offset: %s", esp_err_to_name(err));
+        ESP_LOGE(TAG, "Error saving zebra phase: %s", esp_err_to_name(err));
 
-    err = nvs_set_u8(nvs_handle, "zebra_enabled", calibration_zebra_enabled ? 1 : 0);
+    err = nvs_set_u8(nvs_handle, "zebra_enabled", s->zebra_enabled ? 1 : 0);
     if (err != ESP_OK)
         ESP_LOGE(TAG, "Error saving zebra enabled: %s", esp_err_to_name(err));
 
@@ -370,5 +599,5 @@ static void position_sensor_save_calibration_data(void)
 
     nvs_close(nvs_handle);
 
-    ESP_LOGI(TAG, "Calibration data saved to NVS");
+    ESP_LOGI(TAG, "Shade %u: calibration data saved to NVS", s->shade + 1);
 }
@@ -31,27 +31,44 @@ extern "C"
     {
         CALIBRATION_STEP_UPPER,
         CALIBRATION_STEP_LOWER,
-        CALIBRATION_STEP_ZEBRA_OFFSET,
+        CALIBRATION_STEP_BACKLASH,     // Автоматическое измерение люфта редуктора
+        CALIBRATION_STEP_ZEBRA_OPEN,   // Полосы зебры совмещены (просвет)
+        CALIBRATION_STEP_ZEBRA_CLOSED, // Ближайшее положение, где полосы перекрыты
         CALIBRATION_STEP_COMPLETE
     } calibration_step_t;
 
     typedef const char *(*calibration_step_callback_t)(calibration_step_t step);
 
+    // Датчики всех штор платы (CONFIG_SHADE_COUNT), у каждой своя калибровка
     void position_sensor_init(void);
-    uint32_t position_sensor_read(void);
-    void position_sensor_set_calibration(uint32_t min_pos, uint32_t max_pos);
-    void position_sensor_calibrate_start(void);
-    bool position_sensor_is_calibrated(void);
-    float position_sensor_get_percentage(void);
+    uint32_t position_sensor_read(uint8_t shade);
+    // Усредненное чтение без скользящего фильтра и ограничения диапазона
+    uint32_t position_sensor_read_raw(uint8_t shade);
+    void position_sensor_set_calibration(uint8_t shade, uint32_t min_pos, uint32_t max_pos);
+    void position_sensor_calibrate_start(uint8_t shade);
+    bool position_sensor_is_calibrated(uint8_t shade);
+    float position_sensor_get_percentage(uint8_t shade);
 
     // Новые функции для пошаговой калибровки
-    calibration_step_callback_t position_sensor_start_calibration(void);
-    calibration_step_t position_sensor_next_calibration_step(void);
-    void position_sensor_save_calibration_step(uint32_t position);
-    uint32_t position_sensor_get_zebra_offset(void);
-    uint32_t position_sensor_get_min_position(void);
-    uint32_t position_sensor_get_max_position(void);
-    static void position_sensor_save_calibration_data(void);
+    calibration_step_callback_t position_sensor_start_calibration(uint8_t shade);
+    calibration_step_t position_sensor_next_calibration_step(uint8_t shade);
+    calibration_step_t position_sensor_get_calibration_step(uint8_t shade);
+    // position - значение АЦП, position_steps - позиция мотора в шагах от верхней точки
+    void position_sensor_save_calibration_step(uint8_t shade, uint32_t position, int32_t position_steps);
+    uint32_t position_sensor_get_min_position(uint8_t shade);
+    uint32_t position_sensor_get_max_position(uint8_t shade);
+
+    // Калибровка хода в шагах (0 - ход не откалиброван)
+    uint32_t position_sensor_get_travel_steps(uint8_t shade);
+
+    // Люфт редуктора в шагах, сохраняется вместе с калибровкой
+    void position_sensor_set_backlash_steps(uint8_t shade, uint32_t steps);
+    uint32_t position_sensor_get_backlash_steps(uint8_t shade);
+
+    // Модель полос зебры: совмещенные положения повторяются с периодом period_steps,
+    // первое из них находится на phase_steps от верхней точки (0 - не откалибровано)
+    uint32_t position_sensor_get_zebra_period_steps(uint8_t shade);
+    uint32_t position_sensor_get_zebra_phase_steps(uint8_t shade);
 
 #ifdef __cplusplus
 }
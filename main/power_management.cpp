@@ -0,0 +1,124 @@
+#include "power_management.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+#ifdef CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
+static const char *TAG = "power_management";
+
+static power_stats_t g_stats = {0};
+static portMUX_TYPE g_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#if defined(CONFIG_POWER_LIGHT_SLEEP) && defined(CONFIG_PM_LIGHT_SLEEP_CALLBACKS)
+#define POWER_STATS_ENABLED
+#endif
+
+#ifdef POWER_STATS_ENABLED
+// Счетчики текущего интервала. Пополняются при выходе из легкого сна
+static uint32_t g_wakeups = 0;
+static int64_t g_sleep_us = 0;
+static int64_t g_interval_start_us = 0;
+static esp_timer_handle_t g_stats_timer = NULL;
+
+// Вызывается при выходе из легкого сна с запрещенными прерываниями
+static esp_err_t IRAM_ATTR power_light_sleep_exit_cb(int64_t sleep_time_us, void *arg)
+{
+    portENTER_CRITICAL_SAFE(&g_stats_lock);
+    g_wakeups++;
+    g_sleep_us += sleep_time_us;
+    portEXIT_CRITICAL_SAFE(&g_stats_lock);
+    return ESP_OK;
+}
+
+// Итог интервала: пробуждения в секунду и доля времени во сне. Сам отчет -
+// тоже пробуждение, поэтому интервал выбирается длинным
+static void power_stats_timer_cb(void *arg)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&g_stats_lock);
+    uint32_t wakeups = g_wakeups;
+    int64_t sleep_us = g_sleep_us;
+    g_wakeups = 0;
+    g_sleep_us = 0;
+    portEXIT_CRITICAL(&g_stats_lock);
+
+    int64_t interval_us = now_us - g_interval_start_us;
+    g_interval_start_us = now_us;
+    if (interval_us <= 0)
+    {
+        return;
+    }
+
+    power_stats_t stats;
+    stats.wakeups = wakeups;
+    stats.wakeups_per_s_x100 = (uint32_t)((int64_t)wakeups * 100000000 / interval_us);
+    stats.sleep_percent = (uint8_t)(sleep_us * 100 / interval_us);
+
+    portENTER_CRITICAL(&g_stats_lock);
+    g_stats = stats;
+    portEXIT_CRITICAL(&g_stats_lock);
+
+    ESP_LOGI(TAG, "Idle: %lu wakeups in %lld s (%lu.%02lu/s), light sleep %u%%", stats.wakeups,
+             interval_us / 1000000, stats.wakeups_per_s_x100 / 100, stats.wakeups_per_s_x100 % 100,
+             stats.sleep_percent);
+}
+#endif
+
+esp_err_t power_management_init(void)
+{
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_XTAL_FREQ,
+#ifdef CONFIG_POWER_LIGHT_SLEEP
+        .light_sleep_enable = true,
+#else
+        .light_sleep_enable = false,
+#endif
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to configure power management: %s", esp_err_to_name(err));
+        return err;
+    }
+
+#ifdef POWER_STATS_ENABLED
+    esp_pm_sleep_cbs_register_config_t sleep_cbs = {};
+    sleep_cbs.exit_cb = power_light_sleep_exit_cb;
+    err = esp_pm_light_sleep_register_cbs(&sleep_cbs);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to register light sleep callbacks: %s", esp_err_to_name(err));
+    }
+
+    esp_timer_create_args_t stats_timer_args = {
+        .callback = &power_stats_timer_cb,
+        .name = "power_stats"};
+    g_interval_start_us = esp_timer_get_time();
+    if (CONFIG_POWER_STATS_INTERVAL_S > 0 && esp_timer_create(&stats_timer_args, &g_stats_timer) == ESP_OK)
+    {
+        esp_timer_start_periodic(g_stats_timer, (uint64_t)CONFIG_POWER_STATS_INTERVAL_S * 1000000);
+    }
+#endif
+
+    ESP_LOGI(TAG, "Power management: %d-%d MHz, light sleep %s", pm_config.max_freq_mhz, pm_config.min_freq_mhz,
+             pm_config.light_sleep_enable ? "on" : "off");
+    return ESP_OK;
+#else
+    ESP_LOGI(TAG, "Power management disabled");
+    return ESP_OK;
+#endif
+}
+
+void power_management_get_stats(power_stats_t *stats)
+{
+    portENTER_CRITICAL(&g_stats_lock);
+    *stats = g_stats;
+    portEXIT_CRITICAL(&g_stats_lock);
+}
@@ -0,0 +1,30 @@
+// components/power_management/power_management.h
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Статистика сна за последний интервал отчета
+    typedef struct
+    {
+        uint32_t wakeups;            // Пробуждения из легкого сна
+        uint32_t wakeups_per_s_x100; // Пробуждений в секунду, x100
+        uint8_t sleep_percent;       // Доля времени в легком сне
+    } power_stats_t;
+
+    // Динамическая частота и автоматический легкий сон в покое (tickless idle).
+    // Модули, которым нужна полная скорость, удерживают свои блокировки esp_pm:
+    // мотор - на ходу, кнопки - на время дребезга, Wi-Fi - вне режима экономии
+    esp_err_t power_management_init(void);
+
+    // Последняя статистика, обновляется раз в CONFIG_POWER_STATS_INTERVAL_S
+    void power_management_get_stats(power_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,507 @@
+#include "wifi_station.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "controller.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#ifdef CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+#include <stddef.h>
+#include <string.h>
+
+static const char *TAG = "wifi_station";
+
+#define WIFI_CACHE_MAGIC 0x57494649 // "WIFI"
+#define WIFI_CACHE_NVS_NAMESPACE "wifi_station"
+#define WIFI_CACHE_NVS_KEY "ap"
+
+// Повторные попытки после неудачного полного сканирования
+#define WIFI_RETRY_MIN_MS 1000
+#define WIFI_RETRY_MAX_MS 30000
+
+// Последняя точка доступа. В RTC памяти переживает программный сброс и
+// watchdog, в NVS - отключение питания. IP адрес запоминает сам DHCP клиент
+// (LWIP_DHCP_RESTORE_LAST_IP) и запрашивает его без обнаружения сервера
+typedef struct
+{
+    uint32_t magic;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t reserved;
+    uint32_t checksum;
+} wifi_cache_t;
+
+static RTC_NOINIT_ATTR wifi_cache_t g_rtc_cache;
+static wifi_cache_t g_cache = {0};
+
+static esp_netif_t *g_netif = NULL;
+static esp_timer_handle_t g_fast_timer = NULL;
+static esp_timer_handle_t g_retry_timer = NULL;
+static uint32_t g_retry_delay_ms = WIFI_RETRY_MIN_MS;
+static bool g_fast_attempt = false; // Идет прямое подключение к запомненной точке
+static bool g_connected = false;
+static int64_t g_connect_start_us = 0;
+static bool g_boot_connected = false;
+
+#ifdef CONFIG_WIFI_POWER_SAVE
+// Политика питания. Переключается из цикла событий и esp_timer
+static SemaphoreHandle_t g_power_mutex = NULL;
+static esp_timer_handle_t g_power_timer = NULL;
+static bool g_power_saving = false;
+static int64_t g_power_since_us = 0;
+static int64_t g_awake_total_us = 0;
+static int64_t g_saving_total_us = 0;
+#ifdef CONFIG_PM_ENABLE
+// Без легкого сна и на полной частоте, пока идет движение или сетевой обмен
+static esp_pm_lock_handle_t g_pm_lock = NULL;
+#endif
+#endif
+
+static uint32_t wifi_cache_checksum(const wifi_cache_t *cache)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)cache, offsetof(wifi_cache_t, checksum));
+}
+
+static bool wifi_cache_is_valid(const wifi_cache_t *cache)
+{
+    return cache->magic == WIFI_CACHE_MAGIC && cache->channel != 0 && cache->checksum == wifi_cache_checksum(cache);
+}
+
+static void wifi_cache_load(void)
+{
+    if (wifi_cache_is_valid(&g_rtc_cache))
+    {
+        g_cache = g_rtc_cache;
+        return;
+    }
+
+    nvs_handle_t nvs_handle;
+    if (nvs_open(WIFI_CACHE_NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK)
+    {
+        return;
+    }
+
+    size_t size = sizeof(g_cache);
+    if (nvs_get_blob(nvs_handle, WIFI_CACHE_NVS_KEY, &g_cache, &size) != ESP_OK || size != sizeof(g_cache) ||
+        !wifi_cache_is_valid(&g_cache))
+    {
+        memset(&g_cache, 0, sizeof(g_cache));
+    }
+    nvs_close(nvs_handle);
+
+    g_rtc_cache = g_cache;
+}
+
+// Запоминание точки доступа. NVS перезаписывается только при смене точки
+static void wifi_cache_store(const uint8_t *bssid, uint8_t channel)
+{
+    if (wifi_cache_is_valid(&g_cache) && g_cache.channel == channel && memcmp(g_cache.bssid, bssid, 6) == 0)
+    {
+        return;
+    }
+
+    g_cache.magic = WIFI_CACHE_MAGIC;
+    memcpy(g_cache.bssid, bssid, 6);
+    g_cache.channel = channel;
+    g_cache.reserved = 0;
+    g_cache.checksum = wifi_cache_checksum(&g_cache);
+    g_rtc_cache = g_cache;
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = nvs_open(WIFI_CACHE_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error opening NVS: %s", esp_err_to_name(err));
+        return;
+    }
+
+    err = nvs_set_blob(nvs_handle, WIFI_CACHE_NVS_KEY, &g_cache, sizeof(g_cache));
+    if (err == ESP_OK)
+        err = nvs_commit(nvs_handle);
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Error saving AP cache: %s", esp_err_to_name(err));
+
+    nvs_close(nvs_handle);
+}
+
+static void wifi_cache_invalidate(void)
+{
+    g_cache.magic = 0;
+    g_rtc_cache.magic = 0;
+}
+
+// Настройка подключения: прямое к запомненной точке или с полным сканированием
+static void wifi_configure(bool fast)
+{
+    wifi_config_t wifi_config = {};
+    strlcpy((char *)wifi_config.sta.ssid, CONFIG_WIFI_SSID, sizeof(wifi_config.sta.ssid));
+    strlcpy((char *)wifi_config.sta.password, CONFIG_WIFI_PASSWORD, sizeof(wifi_config.sta.password));
+    wifi_config.sta.threshold.authmode = strlen(CONFIG_WIFI_PASSWORD) > 0 ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN;
+    wifi_config.sta.pmf_cfg.capable = true;
+
+    if (fast)
+    {
+        // Сканируется один канал, подключение к первой же точке с этим BSSID
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+        wifi_config.sta.channel = g_cache.channel;
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, g_cache.bssid, 6);
+    }
+    else
+    {
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        wifi_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+    }
+
+#ifdef CONFIG_WIFI_POWER_SAVE
+    wifi_config.sta.listen_interval = CONFIG_WIFI_PS_LISTEN_INTERVAL;
+#endif
+
+    g_fast_attempt = fast;
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+}
+
+static void wifi_connect(void)
+{
+    g_connect_start_us = esp_timer_get_time();
+    esp_err_t err = esp_wifi_connect();
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Connect failed: %s", esp_err_to_name(err));
+        return;
+    }
+
+    if (g_fast_attempt)
+    {
+        esp_timer_stop(g_fast_timer);
+        esp_timer_start_once(g_fast_timer, (uint64_t)CONFIG_WIFI_FAST_CONNECT_TIMEOUT_MS * 1000);
+    }
+}
+
+// Точка не ответила на прямое подключение - отменяем попытку, дальше полное сканирование
+static void wifi_fast_timer_cb(void *arg)
+{
+    ESP_LOGW(TAG, "Fast connect timed out");
+    esp_wifi_disconnect();
+}
+
+static void wifi_retry_timer_cb(void *arg)
+{
+    wifi_configure(wifi_cache_is_valid(&g_cache));
+    wifi_connect();
+}
+
+#ifdef CONFIG_WIFI_POWER_SAVE
+// Переключение режима питания. Время в каждом режиме копится, чтобы ток
+// покоя можно было оценить вместе с задержкой команд (поле power_save ответа)
+static void wifi_power_set(bool saving)
+{
+    xSemaphoreTake(g_power_mutex, portMAX_DELAY);
+
+    if (saving == g_power_saving)
+    {
+        xSemaphoreGive(g_power_mutex);
+        return;
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    int64_t spent_us = now_us - g_power_since_us;
+    if (g_power_saving)
+        g_saving_total_us += spent_us;
+    else
+        g_awake_total_us += spent_us;
+    g_power_since_us = now_us;
+    g_power_saving = saving;
+
+    if (saving)
+    {
+        esp_wifi_set_ps(CONFIG_WIFI_PS_LISTEN_INTERVAL > 0 ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+#ifdef CONFIG_PM_ENABLE
+        esp_pm_lock_release(g_pm_lock);
+#endif
+    }
+    else
+    {
+#ifdef CONFIG_PM_ENABLE
+        esp_pm_lock_acquire(g_pm_lock);
+#endif
+        esp_wifi_set_ps(WIFI_PS_NONE);
+    }
+
+    int64_t total_us = g_awake_total_us + g_saving_total_us;
+    ESP_LOGI(TAG, "Power: %s after %lld ms, power save %lld%% of the time", saving ? "modem sleep" : "awake",
+             spent_us / 1000, total_us > 0 ? g_saving_total_us * 100 / total_us : 0);
+
+    xSemaphoreGive(g_power_mutex);
+}
+
+// Хотя бы одна штора платы в движении
+static bool wifi_power_any_moving(void)
+{
+    for (uint8_t shade = 0; shade < CONFIG_SHADE_COUNT; shade++)
+    {
+        if (controller_is_moving(shade))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Окно без экономии истекло
+static void wifi_power_timer_cb(void *arg)
+{
+    if (g_connected && !wifi_power_any_moving())
+    {
+        wifi_power_set(true);
+    }
+}
+
+// Не спать сейчас и еще WIFI_PS_AWAKE_AFTER_MOTION_MS после последней активности
+static void wifi_power_stay_awake(bool moving)
+{
+    esp_timer_stop(g_power_timer);
+    wifi_power_set(false);
+    if (!moving)
+    {
+        esp_timer_start_once(g_power_timer, (uint64_t)CONFIG_WIFI_PS_AWAKE_AFTER_MOTION_MS * 1000);
+    }
+}
+
+// События смены состояния контроллера для цикла событий
+static const esp_event_base_t WIFI_POWER_EVENT = "WIFI_POWER";
+enum
+{
+    WIFI_POWER_EVENT_MOVING,
+    WIFI_POWER_EVENT_IDLE,
+};
+
+static void wifi_power_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    wifi_power_stay_awake(event_id == WIFI_POWER_EVENT_MOVING);
+}
+
+// Вызывается внутри controller_set_state из задач мотора и монитора: ждать
+// мьютекс и менять режим Wi-Fi там нельзя, переключение уходит в цикл событий.
+// Остановка одной шторы только перезапускает окно: таймер проверит остальные
+static void wifi_power_state_cb(uint8_t shade, state_t state, controller_fault_t fault, void *user_data)
+{
+    bool moving = state == MOVING_UP || state == MOVING_DOWN || state == CALIBRATING;
+    if (esp_event_post(WIFI_POWER_EVENT, moving ? WIFI_POWER_EVENT_MOVING : WIFI_POWER_EVENT_IDLE, NULL, 0, 0) !=
+        ESP_OK)
+    {
+        ESP_LOGW(TAG, "Power event queue full");
+    }
+}
+
+static void wifi_power_init(void)
+{
+    g_power_mutex = xSemaphoreCreateMutex();
+
+    esp_timer_create_args_t power_timer_args = {
+        .callback = &wifi_power_timer_cb,
+        .name = "wifi_power"};
+    esp_timer_create(&power_timer_args, &g_power_timer);
+
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "wifi_active", &g_pm_lock);
+    // Подключение - тоже сетевой обмен: до получения адреса блокировка удерживается
+    esp_pm_lock_acquire(g_pm_lock);
+#endif
+
+    // Стартуем без экономии: подключение и первые команды идут на полной скорости
+    g_power_saving = false;
+    g_power_since_us = esp_timer_get_time();
+    esp_wifi_set_ps(WIFI_PS_NONE);
+
+    esp_event_handler_register(WIFI_POWER_EVENT, ESP_EVENT_ANY_ID, wifi_power_event_handler, NULL);
+    controller_add_state_callback(wifi_power_state_cb, NULL);
+}
+#endif
+
+static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
+    {
+        wifi_connect();
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
+    {
+        wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+        esp_timer_stop(g_fast_timer);
+        ESP_LOGI(TAG, "Associated with " MACSTR " on channel %u in %lld ms (%s)", MAC2STR(event->bssid),
+                 event->channel, (esp_timer_get_time() - g_connect_start_us) / 1000,
+                 g_fast_attempt ? "fast" : "full scan");
+        wifi_cache_store(event->bssid, event->channel);
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+        bool was_connected = g_connected;
+        esp_timer_stop(g_fast_timer);
+        g_connected = false;
+#ifdef CONFIG_WIFI_POWER_SAVE
+        // Переподключение - сетевой обмен, без экономии до получения адреса
+        esp_timer_stop(g_power_timer);
+        wifi_power_set(false);
+#endif
+
+        if (was_connected)
+        {
+            // Потеря связи: сначала снова прямо к той же точке
+            ESP_LOGW(TAG, "Disconnected, reason %u", event->reason);
+            g_retry_delay_ms = WIFI_RETRY_MIN_MS;
+            wifi_configure(wifi_cache_is_valid(&g_cache));
+            wifi_connect();
+        }
+        else if (g_fast_attempt)
+        {
+            // Точка сменила канал или недоступна - запомненные данные больше не годятся
+            ESP_LOGW(TAG, "Fast connect failed (reason %u), falling back to full scan", event->reason);
+            wifi_cache_invalidate();
+            wifi_configure(false);
+            wifi_connect();
+        }
+        else
+        {
+            ESP_LOGW(TAG, "Connect failed (reason %u), retry in %lu ms", event->reason, g_retry_delay_ms);
+            esp_timer_start_once(g_retry_timer, (uint64_t)g_retry_delay_ms * 1000);
+            g_retry_delay_ms = g_retry_delay_ms * 2 < WIFI_RETRY_MAX_MS ? g_retry_delay_ms * 2 : WIFI_RETRY_MAX_MS;
+        }
+    }
+    else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
+    {
+        ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        g_connected = true;
+        g_retry_delay_ms = WIFI_RETRY_MIN_MS;
+        ESP_LOGI(TAG, "Got IP " IPSTR " in %lld ms", IP2STR(&event->ip_info.ip),
+                 (esp_timer_get_time() - g_connect_start_us) / 1000);
+
+        if (!g_boot_connected)
+        {
+            g_boot_connected = true;
+            ESP_LOGI(TAG, "Boot: Wi-Fi connected at %lld ms", esp_timer_get_time() / 1000);
+        }
+
+#ifdef CONFIG_WIFI_POWER_SAVE
+        wifi_power_stay_awake(wifi_power_any_moving());
+#endif
+    }
+}
+
+#ifdef CONFIG_WIFI_STATIC_IP
+// Статический адрес: подключение не ждет DHCP
+static void wifi_set_static_ip(void)
+{
+    esp_netif_dhcpc_stop(g_netif);
+
+    esp_netif_ip_info_t ip_info = {};
+    ip_info.ip.addr = esp_ip4addr_aton(CONFIG_WIFI_STATIC_IP_ADDR);
+    ip_info.netmask.addr = esp_ip4addr_aton(CONFIG_WIFI_STATIC_NETMASK);
+    ip_info.gw.addr = esp_ip4addr_aton(CONFIG_WIFI_STATIC_GATEWAY);
+    esp_err_t err = esp_netif_set_ip_info(g_netif, &ip_info);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to set static IP: %s", esp_err_to_name(err));
+        return;
+    }
+
+    esp_netif_dns_info_t dns = {};
+    dns.ip.type = ESP_IPADDR_TYPE_V4;
+    dns.ip.u_addr.ip4.addr = esp_ip4addr_aton(CONFIG_WIFI_STATIC_DNS);
+    esp_netif_set_dns_info(g_netif, ESP_NETIF_DNS_MAIN, &dns);
+}
+#endif
+
+esp_err_t wifi_station_init(void)
+{
+    if (g_netif != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    g_netif = esp_netif_create_default_wifi_sta();
+    if (g_netif == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create station interface");
+        return ESP_FAIL;
+    }
+
+#ifdef CONFIG_WIFI_STATIC_IP
+    wifi_set_static_ip();
+#endif
+
+    wifi_init_config_t init_config = WIFI_INIT_CONFIG_DEFAULT();
+    esp_err_t ret = esp_wifi_init(&init_config);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to init Wi-Fi: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    // Точку доступа запоминаем сами, драйверу писать во flash при каждом подключении незачем
+    esp_wifi_set_storage(WIFI_STORAGE_RAM);
+
+    esp_timer_create_args_t fast_timer_args = {
+        .callback = &wifi_fast_timer_cb,
+        .name = "wifi_fast"};
+    esp_timer_create_args_t retry_timer_args = {
+        .callback = &wifi_retry_timer_cb,
+        .name = "wifi_retry"};
+    if (esp_timer_create(&fast_timer_args, &g_fast_timer) != ESP_OK ||
+        esp_timer_create(&retry_timer_args, &g_retry_timer) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create timers");
+        return ESP_FAIL;
+    }
+
+#ifdef CONFIG_WIFI_POWER_SAVE
+    wifi_power_init();
+#endif
+
+    esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler, NULL);
+    esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, wifi_event_handler, NULL);
+
+    wifi_cache_load();
+    bool fast = wifi_cache_is_valid(&g_cache);
+    if (fast)
+    {
+        ESP_LOGI(TAG, "Fast connect to " MACSTR " on channel %u", MAC2STR(g_cache.bssid), g_cache.channel);
+    }
+
+    esp_wifi_set_mode(WIFI_MODE_STA);
+    wifi_configure(fast);
+
+    ret = esp_wifi_start();
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start Wi-Fi: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Wi-Fi station started, SSID: %s", CONFIG_WIFI_SSID);
+    return ESP_OK;
+}
+
+bool wifi_station_is_connected(void)
+{
+    return g_connected;
+}
+
+bool wifi_station_is_power_saving(void)
+{
+#ifdef CONFIG_WIFI_POWER_SAVE
+    return g_power_saving;
+#else
+    return false;
+#endif
+}
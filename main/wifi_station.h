@@ -0,0 +1,27 @@
+// components/wifi_station/wifi_station.h
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    // Подключение к точке доступа из конфигурации. Не блокирует: соединение
+    // устанавливается и восстанавливается по событиям Wi-Fi. Сначала - прямое
+    // подключение к запомненной точке (канал и BSSID из RTC памяти или NVS),
+    // при неудаче - полное сканирование
+    esp_err_t wifi_station_init(void);
+
+    // Станция подключена и получила IP адрес
+    bool wifi_station_is_connected(void);
+
+    // Радио в режиме экономии (modem sleep). Режим выбирается по состоянию
+    // контроллера: на ходу и некоторое время после остановки экономии нет
+    bool wifi_station_is_power_saving(void);
+
+#ifdef __cplusplus
+}
+#endif